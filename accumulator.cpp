@@ -0,0 +1,128 @@
+#include "accumulator.h"
+#include "vecfrom.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <unistd.h>
+
+namespace raytracer
+{
+    static const char CheckpointMagic[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '2'};
+
+    struct CheckpointHeader
+    {
+        char Magic[8];
+        int32_t Width, Height;
+        int32_t Pass;
+        int32_t SampleCount;
+        float NoiseThreshold;
+        float Elapsed;
+        uint64_t Scene;
+    };
+
+    Accumulator::Accumulator(int width, int height) : Width(width), Height(height)
+    {
+        int size = width * height;
+        Sum.resize(size, Vector3f::Zero());
+        LSum.resize(size, 0);
+        LSqSum.resize(size, 0);
+        Counts.resize(size, 0);
+        Converged.resize(size, 0);
+    }
+
+    void Accumulator::Add(int index, const Vector3f& color)
+    {
+        float l = Luminance(color);
+        Sum[index] += color;
+        LSum[index] += l;
+        LSqSum[index] += l * l;
+        Counts[index]++;
+    }
+
+    Vector3f Accumulator::Resolve(int index) const
+    {
+        return Sum[index] / Counts[index];
+    }
+
+    float Accumulator::RelativeError(int index) const
+    {
+        int n = Counts[index];
+        float mean = LSum[index] / n;
+        float var = std::max(0.0f, LSqSum[index] / n - mean * mean);
+        return std::sqrt(var / n) / (mean + 1e-3f);
+    }
+
+    template<typename T>
+    static bool WriteBuffer(FILE* file, const std::vector<T>& buffer)
+    {
+        return std::fwrite(buffer.data(), sizeof(T), buffer.size(), file) == buffer.size();
+    }
+
+    template<typename T>
+    static bool ReadBuffer(FILE* file, std::vector<T>& buffer)
+    {
+        return std::fread(buffer.data(), sizeof(T), buffer.size(), file) == buffer.size();
+    }
+
+    bool Accumulator::Save(const std::string& path) const
+    {
+        // write next to the target and rename, so a crash never leaves a torn checkpoint
+        auto tmp = path + ".tmp";
+        FILE* file = std::fopen(tmp.c_str(), "wb");
+        if(file == nullptr)
+            return false;
+        CheckpointHeader header;
+        std::memcpy(header.Magic, CheckpointMagic, sizeof(CheckpointMagic));
+        header.Width = Width;
+        header.Height = Height;
+        header.Pass = Pass;
+        header.SampleCount = SampleCount;
+        header.NoiseThreshold = NoiseThreshold;
+        header.Elapsed = Elapsed;
+        header.Scene = Scene;
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+            && WriteBuffer(file, Sum)
+            && WriteBuffer(file, LSum)
+            && WriteBuffer(file, LSqSum)
+            && WriteBuffer(file, Counts)
+            && WriteBuffer(file, Converged);
+        ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+        if(!ok || std::rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool Accumulator::Load(const std::string& path)
+    {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if(file == nullptr)
+            return false;
+        CheckpointHeader header;
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1
+            && std::memcmp(header.Magic, CheckpointMagic, sizeof(CheckpointMagic)) == 0
+            && header.Width == Width && header.Height == Height
+            && header.SampleCount == SampleCount && header.NoiseThreshold == NoiseThreshold
+            && header.Scene == Scene;
+        Accumulator loaded(Width, Height);
+        ok = ok && ReadBuffer(file, loaded.Sum)
+            && ReadBuffer(file, loaded.LSum)
+            && ReadBuffer(file, loaded.LSqSum)
+            && ReadBuffer(file, loaded.Counts)
+            && ReadBuffer(file, loaded.Converged);
+        std::fclose(file);
+        if(!ok)
+            return false;
+        loaded.Pass = header.Pass;
+        loaded.Elapsed = header.Elapsed;
+        loaded.SampleCount = SampleCount;
+        loaded.NoiseThreshold = NoiseThreshold;
+        loaded.Scene = Scene;
+        *this = std::move(loaded);
+        return true;
+    }
+}
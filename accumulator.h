@@ -0,0 +1,37 @@
+#pragma once
+#include "Eigen/Dense"
+#include <vector>
+#include <string>
+#include <cstdint>
+
+using namespace Eigen;
+
+namespace raytracer
+{
+    // Per-pixel state of a progressive render. Everything needed to continue a
+    // render lives here: camera samples are seeded from (pixel, Counts[pixel]),
+    // so restoring the buffers also restores the random state.
+    class Accumulator
+    {
+        public:
+            Accumulator(int width, int height);
+            void Add(int index, const Vector3f& color);
+            Vector3f Resolve(int index) const;
+            float RelativeError(int index) const;
+            bool Save(const std::string& path) const;
+            bool Load(const std::string& path);
+            int Width;
+            int Height;
+            int Pass = 0;
+            float Elapsed = 0;
+            // the render this state belongs to, a checkpoint of another one doesn't load
+            int SampleCount = 0;
+            float NoiseThreshold = 0;
+            uint64_t Scene = 0;
+            std::vector<Vector3f> Sum;
+            std::vector<float> LSum;
+            std::vector<float> LSqSum;
+            std::vector<int> Counts;
+            std::vector<char> Converged;
+    };
+}
@@ -0,0 +1,217 @@
+#include "binaryscene.h"
+#include "vecfrom.h"
+#include "pugixml.hpp"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+namespace raytracer
+{
+    static const char SceneMagic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '1'};
+    static const uint32_t SceneVersion = 1;
+    static const uint64_t BufferAlignment = 64;
+
+    static uint64_t Align(uint64_t offset)
+    {
+        return (offset + BufferAlignment - 1) / BufferAlignment * BufferAlignment;
+    }
+
+    struct StringWriter : pugi::xml_writer
+    {
+        std::string Text;
+        virtual void write(const void* data, size_t size) override
+        {
+            Text.append(static_cast<const char*>(data), size);
+        }
+    };
+
+    struct PendingBuffer
+    {
+        BinaryScene::BufferKind Kind;
+        std::vector<float> Floats;
+        std::vector<int> Ints;
+        uint32_t Count;
+    };
+
+    // moves the numbers of node into a buffer and leaves a buffer="id" reference
+    static void Extract(pugi::xml_node node, BinaryScene::BufferKind kind, std::vector<PendingBuffer>& buffers)
+    {
+        NumberReader reader(node.text().as_string());
+        PendingBuffer buffer;
+        buffer.Kind = kind;
+        if(kind == BinaryScene::BufferKind::Vec3i)
+        {
+            buffer.Ints.reserve(reader.Count());
+            int v;
+            while(reader.Read(v))
+                buffer.Ints.push_back(v);
+            buffer.Count = buffer.Ints.size() / 3;
+            buffer.Ints.resize(buffer.Count * 3);
+        }
+        else
+        {
+            buffer.Floats.reserve(reader.Count());
+            float v;
+            while(reader.Read(v))
+                buffer.Floats.push_back(v);
+            int size = kind == BinaryScene::BufferKind::Vec3f ? 3 : 2;
+            buffer.Count = buffer.Floats.size() / size;
+            buffer.Floats.resize(buffer.Count * size);
+        }
+        while(node.first_child())
+            node.remove_child(node.first_child());
+        node.append_attribute("buffer") = (int)buffers.size();
+        buffers.push_back(std::move(buffer));
+    }
+
+    static void ExtractFaces(pugi::xml_node node, std::vector<PendingBuffer>& buffers)
+    {
+        for(auto& child: node.children())
+        {
+            if(std::strcmp(child.name(), "Faces") == 0 && std::strcmp(child.attribute("plyFile").as_string(), "") == 0)
+                Extract(child, BinaryScene::BufferKind::Vec3i, buffers);
+            else
+                ExtractFaces(child, buffers);
+        }
+    }
+
+    bool BinaryScene::Convert(const char* xmlPath, const char* outPath)
+    {
+        pugi::xml_document doc;
+        if(!doc.load_file(xmlPath))
+        {
+            std::cerr << "cannot read " << xmlPath << std::endl;
+            return false;
+        }
+        auto scene = doc.child("Scene");
+        std::vector<PendingBuffer> buffers;
+        if(scene.child("VertexData"))
+            Extract(scene.child("VertexData"), BufferKind::Vec3f, buffers);
+        if(scene.child("TexCoordData"))
+            Extract(scene.child("TexCoordData"), BufferKind::Vec2f, buffers);
+        ExtractFaces(scene.child("Objects"), buffers);
+
+        StringWriter xml;
+        doc.save(xml, "", pugi::format_raw);
+
+        Header header = {};
+        std::memcpy(header.Magic, SceneMagic, sizeof(SceneMagic));
+        header.Version = SceneVersion;
+        header.BufferCount = buffers.size();
+        header.XmlOffset = sizeof(Header) + sizeof(BufferEntry) * buffers.size();
+        header.XmlSize = xml.Text.size();
+        std::vector<BufferEntry> table(buffers.size());
+        uint64_t offset = header.XmlOffset + header.XmlSize;
+        for(size_t i = 0; i < buffers.size(); i++)
+        {
+            offset = Align(offset);
+            table[i].Kind = buffers[i].Kind;
+            table[i].Count = buffers[i].Count;
+            table[i].Offset = offset;
+            offset += buffers[i].Floats.size() * sizeof(float) + buffers[i].Ints.size() * sizeof(int);
+        }
+
+        auto tmp = std::string(outPath) + ".tmp";
+        FILE* file = std::fopen(tmp.c_str(), "wb");
+        if(file == nullptr)
+        {
+            std::cerr << "cannot write " << outPath << std::endl;
+            return false;
+        }
+        bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1
+            && std::fwrite(table.data(), sizeof(BufferEntry), table.size(), file) == table.size()
+            && std::fwrite(xml.Text.data(), 1, xml.Text.size(), file) == xml.Text.size();
+        const char zeros[BufferAlignment] = {};
+        uint64_t written = header.XmlOffset + header.XmlSize;
+        for(size_t i = 0; ok && i < buffers.size(); i++)
+        {
+            ok = std::fwrite(zeros, 1, table[i].Offset - written, file) == table[i].Offset - written;
+            auto& b = buffers[i];
+            ok = ok && std::fwrite(b.Floats.data(), sizeof(float), b.Floats.size(), file) == b.Floats.size()
+                && std::fwrite(b.Ints.data(), sizeof(int), b.Ints.size(), file) == b.Ints.size();
+            written = table[i].Offset + b.Floats.size() * sizeof(float) + b.Ints.size() * sizeof(int);
+        }
+        ok = std::fclose(file) == 0 && ok;
+        if(!ok || std::rename(tmp.c_str(), outPath) != 0)
+        {
+            std::remove(tmp.c_str());
+            std::cerr << "cannot write " << outPath << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool BinaryScene::IsBinary(const char* path)
+    {
+        FILE* file = std::fopen(path, "rb");
+        if(file == nullptr)
+            return false;
+        char magic[sizeof(SceneMagic)];
+        bool ok = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+            && std::memcmp(magic, SceneMagic, sizeof(magic)) == 0;
+        std::fclose(file);
+        return ok;
+    }
+
+    BinaryScene::BinaryScene(const char* path) : _file(path)
+    {
+        if(_file.Size() < sizeof(Header))
+        {
+            _file.Close();
+            return;
+        }
+        auto h = header();
+        bool ok = std::memcmp(h->Magic, SceneMagic, sizeof(SceneMagic)) == 0
+            && h->Version == SceneVersion
+            && sizeof(Header) + sizeof(BufferEntry) * (uint64_t)h->BufferCount <= _file.Size()
+            && h->XmlOffset + h->XmlSize <= _file.Size();
+        if(!ok)
+            _file.Close();
+    }
+
+    const BinaryScene::Header* BinaryScene::header() const
+    {
+        return reinterpret_cast<const Header*>(_file.Data());
+    }
+
+    const char* BinaryScene::Xml() const
+    {
+        return reinterpret_cast<const char*>(_file.Data() + header()->XmlOffset);
+    }
+
+    size_t BinaryScene::XmlSize() const
+    {
+        return header()->XmlSize;
+    }
+
+    template<typename T>
+    bool BinaryScene::read(int id, BufferKind kind, std::vector<T>& out) const
+    {
+        if(!Valid() || id < 0 || (uint32_t)id >= header()->BufferCount)
+            return false;
+        auto& entry = reinterpret_cast<const BufferEntry*>(_file.Data() + sizeof(Header))[id];
+        if(entry.Kind != kind || entry.Offset + (uint64_t)entry.Count * sizeof(T) > _file.Size())
+            return false;
+        out.resize(entry.Count);
+        // Eigen vectors are plain arrays of their scalars, copy into those
+        if(entry.Count > 0)
+            std::memcpy(out.data()->data(), _file.Data() + entry.Offset, entry.Count * sizeof(T));
+        return true;
+    }
+
+    bool BinaryScene::Read(int id, std::vector<Vector3f>& out) const
+    {
+        return read(id, BufferKind::Vec3f, out);
+    }
+
+    bool BinaryScene::Read(int id, std::vector<Vector2f>& out) const
+    {
+        return read(id, BufferKind::Vec2f, out);
+    }
+
+    bool BinaryScene::Read(int id, std::vector<Vector3i>& out) const
+    {
+        return read(id, BufferKind::Vec3i, out);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "Eigen/Dense"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "mappedfile.h"
+
+using namespace Eigen;
+
+namespace raytracer
+{
+    // Compact scene file: the scene XML with its bulk number lists (VertexData,
+    // TexCoordData, inline Faces) moved into 64 byte aligned binary buffers.
+    // The stripped XML refers to them by a buffer="index" attribute. Loading
+    // maps the file, so the buffers are read straight from the page cache.
+    //
+    // layout: header, buffer table, xml text, buffers
+    class BinaryScene
+    {
+        public:
+            enum class BufferKind : uint32_t
+            {
+                Vec3f,
+                Vec2f,
+                Vec3i
+            };
+
+            struct Header
+            {
+                char Magic[8];
+                uint32_t Version;
+                uint32_t BufferCount;
+                uint64_t XmlOffset;
+                uint64_t XmlSize;
+            };
+
+            struct BufferEntry
+            {
+                BufferKind Kind;
+                uint32_t Count;
+                uint64_t Offset;
+            };
+
+            // writes the XML scene at xmlPath as a binary scene to outPath
+            static bool Convert(const char* xmlPath, const char* outPath);
+            // checks the magic without mapping the whole file
+            static bool IsBinary(const char* path);
+
+            BinaryScene(const char* path);
+
+            bool Valid() const { return _file.Data() != nullptr; }
+            const char* Xml() const;
+            size_t XmlSize() const;
+            // the whole file
+            const unsigned char* Data() const { return _file.Data(); }
+            size_t Size() const { return _file.Size(); }
+
+            // copies buffer id into out, false if it is missing or of another kind
+            bool Read(int id, std::vector<Vector3f>& out) const;
+            bool Read(int id, std::vector<Vector2f>& out) const;
+            bool Read(int id, std::vector<Vector3i>& out) const;
+        private:
+            template<typename T>
+            bool read(int id, BufferKind kind, std::vector<T>& out) const;
+            const Header* header() const;
+
+            MappedFile _file;
+    };
+}
@@ -1,5 +1,6 @@
 #include "camera.h"
 #include <cmath>
+#include <algorithm>
 #include <iostream>
 
 namespace raytracer
@@ -39,7 +40,22 @@ namespace raytracer
                 toneMapper = new ACESToneMapper(node.child("Tonemap"));
             }
             Gamma = node.child("Tonemap").child("Gamma").text().as_float();
+            if(std::strcmp(node.child("Tonemap").child("Accuracy").text().as_string(), "Fast") == 0)
+                Accuracy = TonemapAccuracy::Fast;
+            ExrCompression = node.child("EXRCompression").text().as_string("none");
         }
+        if(node.child("Progressive"))
+        {
+            auto prog = node.child("Progressive");
+            Progressive = true;
+            TimeLimit = prog.child("TimeLimit").text().as_float(0);
+            SampleCount = prog.child("SampleCount").text().as_int(NumSamples);
+            NoiseThreshold = prog.child("NoiseThreshold").text().as_float(0);
+            SnapshotInterval = prog.child("SnapshotInterval").text().as_float(0);
+            CheckpointInterval = prog.child("CheckpointInterval").text().as_float(0);
+        }
+        int samples = Progressive ? SampleCount : NumSamples;
+        footprint = std::max(1 / std::sqrt((float)std::max(samples, 1)), 0.125f);
         row = std::sqrt(NumSamples);
         col = NumSamples / row;
         if(std::strcmp(node.attribute("type").as_string(), "lookAt") == 0)
@@ -76,6 +92,7 @@ namespace raytracer
             float sv = (y + .5) * svv;
             Vector3f s = lu + (u * su) - (v * sv);
             samples.push_back(Ray(Position, (s - Position).normalized()));
+            setDifferentials(samples.back(), su, sv);
         }
         else
         {
@@ -83,26 +100,28 @@ namespace raytracer
             {
                 for(int j = 0; j < col; j++)
                 {
-                    float rx = (j + rnd(generator)) / col;
-                    float ry = (i + rnd(generator)) / row;
+                    float rx = (j + rnd(Random::Thread())) / col;
+                    float ry = (i + rnd(Random::Thread())) / row;
                     float su = (x + rx) * suv;
                     float sv = (y + ry) * svv;
                     Vector3f q = lu + (u * su) - (v * sv);
-                    float t = rnd(generator);
+                    float t = rnd(Random::Thread());
                     if(!FocusEnabled)
                     {
                         samples.push_back(Ray(Position, (q - Position).normalized(), t));
+                        setDifferentials(samples.back(), su, sv);
                     }
                     else
                     {
                         Vector3f dir = (q - Position).normalized();
                         float tfd = FocusDistance / dir.dot(-w);
                         Vector3f p = Position + dir * tfd;
-                        float rsu = (rnd(generator) - .5f) * ApertureSize;
-                        float rsv = (rnd(generator) - .5f) * ApertureSize;
+                        float rsu = (rnd(Random::Thread()) - .5f) * ApertureSize;
+                        float rsv = (rnd(Random::Thread()) - .5f) * ApertureSize;
                         Vector3f s = Position + rsu * u + rsv * v;
                         dir = (p - s).normalized();
                         samples.push_back(Ray(s, dir, t));
+                        setDifferentials(samples.back(), su, sv);
                     }                    
                 }
             }
@@ -110,6 +129,50 @@ namespace raytracer
         return samples;
     }
 
+    Ray Camera::GetSample(int x, int y)
+    {
+        float su = (x + rnd(Random::Thread())) * suv;
+        float sv = (y + rnd(Random::Thread())) * svv;
+        Vector3f q = lu + (u * su) - (v * sv);
+        float t = rnd(Random::Thread());
+        Vector3f dir = (q - Position).normalized();
+        Ray ray;
+        if(!FocusEnabled)
+        {
+            ray = Ray(Position, dir, t);
+        }
+        else
+        {
+            float tfd = FocusDistance / dir.dot(-w);
+            Vector3f p = Position + dir * tfd;
+            float rsu = (rnd(Random::Thread()) - .5f) * ApertureSize;
+            float rsv = (rnd(Random::Thread()) - .5f) * ApertureSize;
+            Vector3f s = Position + rsu * u + rsv * v;
+            ray = Ray(s, (p - s).normalized(), t);
+        }
+        setDifferentials(ray, su, sv);
+        return ray;
+    }
+
+    // the offset rays leave from the same lens point and pass through the
+    // focal plane where the neighbouring samples would
+    void Camera::setDifferentials(Ray& ray, float su, float sv)
+    {
+        auto through = [&](Vector3f q) -> Vector3f
+        {
+            Vector3f dir = (q - Position).normalized();
+            if(!FocusEnabled)
+                return dir;
+            Vector3f p = Position + dir * (FocusDistance / dir.dot(-w));
+            return (p - ray.Origin).normalized();
+        };
+        ray.HasDifferentials = true;
+        ray.RxOrigin = ray.Origin;
+        ray.RyOrigin = ray.Origin;
+        ray.RxDirection = through(lu + u * (su + suv * footprint) - v * sv);
+        ray.RyDirection = through(lu + u * su - v * (sv + svv * footprint));
+    }
+
     std::ostream& operator<<(std::ostream& os, const Camera& cam)
     {
         os << "Position " << cam.Position << std::endl;
@@ -7,6 +7,7 @@
 #include <vector>
 #include <random>
 #include "tonemapper.h"
+#include "rng.h"
 
 using namespace Eigen;
 
@@ -17,6 +18,7 @@ namespace raytracer
         public:
             Camera(pugi::xml_node node);
             std::vector<Ray> GetRay(int x, int y);
+            Ray GetSample(int x, int y);
             Vector3f Position;
             Vector3f Gaze;
             Vector3f GazePoint;
@@ -33,9 +35,19 @@ namespace raytracer
             friend std::ostream& operator<<(std::ostream& os, const Camera& cam);
             bool Tonemap = false;
             float Gamma;
+            // position in Scene::Cameras, materials keep reflectances per camera
+            int Index = 0;
             ToneMapper* toneMapper;
+            std::string ExrCompression = "none";
+            TonemapAccuracy Accuracy = TonemapAccuracy::Exact;
+            // progressive rendering
+            bool Progressive = false;
+            float TimeLimit = 0;
+            int SampleCount;
+            float NoiseThreshold = 0;
+            float SnapshotInterval = 0;
+            float CheckpointInterval = 0;
         private:
-            std::default_random_engine generator;
             std::uniform_real_distribution<float> rnd;
             Vector3f img_center;
             Vector3f u, v, w;
@@ -43,5 +55,8 @@ namespace raytracer
             Vector3f lu;
             int row;
             int col;
+            // spacing of the differential rays in pixels, shrinks as samples per pixel grow
+            float footprint;
+            void setDifferentials(Ray& ray, float su, float sv);
     };
 }
\ No newline at end of file
@@ -0,0 +1,353 @@
+#include "distributed.h"
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <csignal>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace raytracer
+{
+    // Camera == -1 asks the worker to exit
+    struct TileHeader
+    {
+        int32_t Camera;
+        int32_t X0, Y0, X1, Y1;
+    };
+
+    static bool WriteFull(int fd, const void* data, size_t size)
+    {
+        auto p = (const char*)data;
+        while(size > 0)
+        {
+            ssize_t n = write(fd, p, size);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    static bool ReadFull(int fd, void* data, size_t size)
+    {
+        auto p = (char*)data;
+        while(size > 0)
+        {
+            ssize_t n = read(fd, p, size);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                return false;
+            p += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    static sockaddr_un SocketAddress(const std::string& path)
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+        return addr;
+    }
+
+    Coordinator::Coordinator(Scene& scene, const std::string& socketPath, int tileSize, int tileTimeout)
+        : _scene(scene), _path(socketPath), _tileSize(tileSize), _tileTimeout(tileTimeout)
+    {
+        // a worker dying mid write must not take the coordinator down
+        std::signal(SIGPIPE, SIG_IGN);
+        unlink(_path.c_str());
+        auto addr = SocketAddress(_path);
+        _listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(_listener < 0 || bind(_listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(_listener, 64) != 0)
+        {
+            std::cerr << "cannot listen on " << _path << ": " << std::strerror(errno) << std::endl;
+            if(_listener >= 0)
+                close(_listener);
+            _listener = -1;
+        }
+    }
+
+    Coordinator::~Coordinator()
+    {
+        if(_listener >= 0)
+        {
+            close(_listener);
+            unlink(_path.c_str());
+        }
+        for(auto pid: _children)
+        {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+
+    void Coordinator::Spawn(const std::vector<std::string>& command, int count)
+    {
+        if(_listener < 0)
+            return;
+        for(int i = 0; i < count; i++)
+        {
+            pid_t pid = fork();
+            if(pid == 0)
+            {
+                std::vector<char*> argv;
+                for(auto& arg: command)
+                    argv.push_back(const_cast<char*>(arg.c_str()));
+                argv.push_back(nullptr);
+                // argv[0] has no slash when started through PATH, run this binary itself
+                execv("/proc/self/exe", argv.data());
+                execvp(argv[0], argv.data());
+                std::cerr << "cannot start worker " << argv[0] << ": " << std::strerror(errno) << std::endl;
+                _exit(1);
+            }
+            if(pid > 0)
+                _children.push_back(pid);
+        }
+    }
+
+    int Coordinator::Reap()
+    {
+        for(int i = 0; i < (int)_children.size(); i++)
+        {
+            if(waitpid(_children[i], nullptr, WNOHANG) == _children[i])
+            {
+                _children.erase(_children.begin() + i);
+                i--;
+            }
+        }
+        return _children.size();
+    }
+
+    void Coordinator::Render()
+    {
+        struct Connection
+        {
+            int Fd;
+            // the worker's process, only known for workers on this machine
+            pid_t Pid;
+            bool Busy;
+            TileHeader Tile;
+            std::chrono::steady_clock::time_point Sent;
+            // the reply is read as it arrives, so a worker that stops halfway
+            // can't block the coordinator
+            TileHeader Header;
+            std::vector<Vector3f> Pixels;
+            size_t Received;
+        };
+        std::deque<TileHeader> queue;
+        std::vector<std::vector<Vector3f>> images(_scene.Cameras.size());
+        std::vector<int> remaining(_scene.Cameras.size(), 0);
+        int pending = 0;
+        for(int c = 0; c < (int)_scene.Cameras.size(); c++)
+        {
+            auto& cam = _scene.Cameras[c];
+            if(cam.Progressive)
+                continue;
+            int width = cam.ImageResolution.x();
+            int height = cam.ImageResolution.y();
+            images[c].resize(width * height);
+            for(int y = 0; y < height; y += _tileSize)
+            {
+                for(int x = 0; x < width; x += _tileSize)
+                {
+                    TileHeader tile = {c, x, y, std::min(x + _tileSize, width), std::min(y + _tileSize, height)};
+                    queue.push_back(tile);
+                    remaining[c]++;
+                    pending++;
+                }
+            }
+        }
+
+        auto finish = [&](const TileHeader& tile, const std::vector<Vector3f>& pixels)
+        {
+            auto& cam = _scene.Cameras[tile.Camera];
+            int width = tile.X1 - tile.X0;
+            for(int y = tile.Y0; y < tile.Y1; y++)
+            {
+                std::copy(pixels.begin() + (y - tile.Y0) * width, pixels.begin() + (y - tile.Y0 + 1) * width,
+                    images[tile.Camera].begin() + y * cam.ImageResolution.x() + tile.X0);
+            }
+            pending--;
+            if(--remaining[tile.Camera] == 0)
+            {
+                _scene.WriteImage(cam, images[tile.Camera]);
+                std::vector<Vector3f>().swap(images[tile.Camera]);
+            }
+        };
+
+        // progressive cameras stop on time or noise, the coordinator renders them
+        // while the workers take the tiles
+        std::thread progressive([this]()
+        {
+            for(auto& cam: _scene.Cameras)
+            {
+                if(cam.Progressive)
+                    _scene.RenderProgressive(cam);
+            }
+        });
+
+        std::vector<Connection> workers;
+        auto drop = [&](int i)
+        {
+            close(workers[i].Fd);
+            if(workers[i].Busy)
+            {
+                std::cerr << "worker lost, re-queuing tile " << workers[i].Tile.X0 << "," << workers[i].Tile.Y0 << std::endl;
+                queue.push_front(workers[i].Tile);
+            }
+            workers.erase(workers.begin() + i);
+        };
+
+        while(pending > 0)
+        {
+            // hand out work
+            for(int i = 0; i < (int)workers.size() && !queue.empty(); i++)
+            {
+                if(workers[i].Busy)
+                    continue;
+                workers[i].Tile = queue.front();
+                queue.pop_front();
+                workers[i].Busy = true;
+                workers[i].Sent = std::chrono::steady_clock::now();
+                workers[i].Pixels.resize((workers[i].Tile.X1 - workers[i].Tile.X0) * (workers[i].Tile.Y1 - workers[i].Tile.Y0));
+                workers[i].Received = 0;
+                if(!WriteFull(workers[i].Fd, &workers[i].Tile, sizeof(TileHeader)))
+                {
+                    drop(i);
+                    i--;
+                }
+            }
+
+            if(workers.empty() && Reap() == 0)
+            {
+                // nobody left to render, finish locally
+                while(!queue.empty())
+                {
+                    auto tile = queue.front();
+                    queue.pop_front();
+                    auto pixels = _scene.RenderTile(_scene.Cameras[tile.Camera], tile.X0, tile.Y0, tile.X1, tile.Y1,
+                        std::thread::hardware_concurrency());
+                    finish(tile, pixels);
+                }
+                break;
+            }
+
+            // a worker that hangs while connected would hold its tile forever
+            auto now = std::chrono::steady_clock::now();
+            for(int i = workers.size() - 1; i >= 0; i--)
+            {
+                if(!workers[i].Busy || now - workers[i].Sent < std::chrono::seconds(_tileTimeout))
+                    continue;
+                std::cerr << "worker timed out after " << _tileTimeout << "s" << std::endl;
+                if(std::find(_children.begin(), _children.end(), workers[i].Pid) != _children.end())
+                    kill(workers[i].Pid, SIGKILL);
+                drop(i);
+            }
+
+            std::vector<pollfd> fds;
+            fds.push_back({_listener, POLLIN, 0});
+            for(auto& w: workers)
+                fds.push_back({w.Fd, POLLIN, 0});
+            if(poll(fds.data(), fds.size(), 500) <= 0)
+                continue;
+
+            // results first, indices into fds shift once workers are dropped
+            for(int i = workers.size() - 1; i >= 0; i--)
+            {
+                if(fds[i + 1].revents == 0)
+                    continue;
+                auto& w = workers[i];
+                size_t headerSize = sizeof(TileHeader);
+                size_t total = headerSize + w.Pixels.size() * sizeof(Vector3f);
+                // an idle worker has nothing to send, readable means it closed
+                bool ok = w.Busy;
+                while(ok && w.Received < total)
+                {
+                    bool header = w.Received < headerSize;
+                    char* dst = header ? (char*)&w.Header + w.Received : (char*)w.Pixels.data() + (w.Received - headerSize);
+                    ssize_t n = read(w.Fd, dst, (header ? headerSize : total) - w.Received);
+                    if(n < 0 && errno == EINTR)
+                        continue;
+                    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                        break;
+                    if(n <= 0)
+                        ok = false;
+                    else
+                        w.Received += n;
+                    if(ok && header && w.Received == headerSize)
+                        ok = std::memcmp(&w.Header, &w.Tile, headerSize) == 0;
+                }
+                if(!ok)
+                {
+                    drop(i);
+                    continue;
+                }
+                if(w.Received < total)
+                    continue;
+                w.Busy = false;
+                finish(w.Header, w.Pixels);
+            }
+            if(fds[0].revents & POLLIN)
+            {
+                int fd = accept(_listener, nullptr, nullptr);
+                ucred peer = {};
+                socklen_t length = sizeof(peer);
+                if(fd >= 0 && getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0)
+                    peer.pid = 0;
+                if(fd >= 0)
+                {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+                    workers.push_back({fd, peer.pid, false, TileHeader(), {}, TileHeader(), {}, 0});
+                }
+            }
+        }
+
+        TileHeader stop = {-1, 0, 0, 0, 0};
+        for(auto& w: workers)
+        {
+            WriteFull(w.Fd, &stop, sizeof(stop));
+            close(w.Fd);
+        }
+        progressive.join();
+    }
+
+    int RunWorker(Scene& scene, const std::string& socketPath, int numThreads)
+    {
+        auto addr = SocketAddress(socketPath);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        // the coordinator may still be setting up
+        int attempts = 50;
+        while(connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            if(--attempts == 0)
+            {
+                std::cerr << "cannot connect to " << socketPath << ": " << std::strerror(errno) << std::endl;
+                close(fd);
+                return 1;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        TileHeader tile;
+        while(ReadFull(fd, &tile, sizeof(tile)) && tile.Camera >= 0 && tile.Camera < (int)scene.Cameras.size())
+        {
+            auto pixels = scene.RenderTile(scene.Cameras[tile.Camera], tile.X0, tile.Y0, tile.X1, tile.Y1, numThreads);
+            if(!WriteFull(fd, &tile, sizeof(tile)) || !WriteFull(fd, pixels.data(), pixels.size() * sizeof(Vector3f)))
+                break;
+        }
+        close(fd);
+        return 0;
+    }
+}
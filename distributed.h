@@ -0,0 +1,34 @@
+#pragma once
+#include "scene.h"
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace raytracer
+{
+    // Splits every camera into tiles and hands them to worker processes over a
+    // unix socket. Workers load the scene themselves and send back float tiles.
+    // A worker that disconnects, or holds a tile longer than the tile timeout,
+    // gets its tile re-queued; if no worker is left the coordinator finishes the
+    // remaining tiles itself.
+    class Coordinator
+    {
+        public:
+            // tileTimeout is in seconds
+            Coordinator(Scene& scene, const std::string& socketPath, int tileSize, int tileTimeout);
+            ~Coordinator();
+            void Spawn(const std::vector<std::string>& command, int count);
+            void Render();
+        private:
+            Scene& _scene;
+            std::string _path;
+            int _tileSize;
+            int _tileTimeout;
+            int _listener;
+            std::vector<pid_t> _children;
+            int Reap();
+    };
+
+    // Connects to a coordinator and renders tiles until told to stop.
+    int RunWorker(Scene& scene, const std::string& socketPath, int numThreads);
+}
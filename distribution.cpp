@@ -0,0 +1,94 @@
+#include "distribution.h"
+#include <algorithm>
+
+namespace raytracer
+{
+    AliasTable::AliasTable(const std::vector<float>& weights)
+    {
+        int n = weights.size();
+        _prob.resize(n);
+        _alias.resize(n);
+        _pdf.resize(n);
+        Total = 0;
+        for(auto w: weights)
+            Total += w;
+        if(n == 0)
+            return;
+        std::vector<float> scaled(n);
+        std::vector<int> small, large;
+        for(int i = 0; i < n; i++)
+        {
+            // all zero weights fall back to uniform
+            _pdf[i] = Total > 0 ? weights[i] / Total : 1.0f / n;
+            scaled[i] = _pdf[i] * n;
+            if(scaled[i] < 1)
+                small.push_back(i);
+            else
+                large.push_back(i);
+        }
+        while(!small.empty() && !large.empty())
+        {
+            int s = small.back(); small.pop_back();
+            int l = large.back(); large.pop_back();
+            _prob[s] = scaled[s];
+            _alias[s] = l;
+            scaled[l] = (scaled[l] + scaled[s]) - 1;
+            if(scaled[l] < 1)
+                small.push_back(l);
+            else
+                large.push_back(l);
+        }
+        // leftovers are 1 up to rounding
+        for(int i: large)
+        {
+            _prob[i] = 1;
+            _alias[i] = i;
+        }
+        for(int i: small)
+        {
+            _prob[i] = 1;
+            _alias[i] = i;
+        }
+    }
+
+    Distribution2D::Distribution2D(const std::vector<float>& weights, int width, int height)
+        : Width(width), Height(height)
+    {
+        std::vector<float> rows(height);
+        _conditional.reserve(height);
+        for(int y = 0; y < height; y++)
+        {
+            std::vector<float> row(weights.begin() + y * width, weights.begin() + (y + 1) * width);
+            _conditional.emplace_back(row);
+            rows[y] = _conditional.back().Total;
+        }
+        _marginal = AliasTable(rows);
+    }
+
+    void Distribution2D::Sample(float r0, float r1, float r2, float r3, float& u, float& v, float& pdf) const
+    {
+        float py, px;
+        int y = _marginal.Sample(r0, py);
+        int x = _conditional[y].Sample(r1, px);
+        u = (x + r2) / Width;
+        v = (y + r3) / Height;
+        pdf = py * px * Width * Height;
+    }
+
+    float Distribution2D::Pdf(float u, float v) const
+    {
+        int x = std::min(std::max((int)(u * Width), 0), Width - 1);
+        int y = std::min(std::max((int)(v * Height), 0), Height - 1);
+        return _marginal.Pdf(y) * _conditional[y].Pdf(x) * Width * Height;
+    }
+
+    int AliasTable::Sample(float u, float& pdf) const
+    {
+        int n = _prob.size();
+        float scaled = u * n;
+        int i = std::min((int)scaled, n - 1);
+        int index = (scaled - i) < _prob[i] ? i : _alias[i];
+        pdf = _pdf[index];
+        return index;
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+
+namespace raytracer
+{
+    // Walker/Vose alias table: draws index i with probability weights[i] / sum in O(1).
+    class AliasTable
+    {
+        public:
+            AliasTable() {}
+            AliasTable(const std::vector<float>& weights);
+            int Sample(float u, float& pdf) const;
+            float Pdf(int index) const { return _pdf[index]; }
+            int Size() const { return _pdf.size(); }
+            float Total = 0;
+        private:
+            std::vector<float> _prob;
+            std::vector<int> _alias;
+            std::vector<float> _pdf;
+    };
+
+    // Piecewise constant density over [0,1]^2 from a width x height grid of weights,
+    // sampled through a marginal table over rows and one conditional table per row.
+    class Distribution2D
+    {
+        public:
+            Distribution2D() {}
+            Distribution2D(const std::vector<float>& weights, int width, int height);
+            // density is with respect to area in [0,1]^2
+            void Sample(float r0, float r1, float r2, float r3, float& u, float& v, float& pdf) const;
+            float Pdf(float u, float v) const;
+            int Width = 0;
+            int Height = 0;
+        private:
+            AliasTable _marginal;
+            std::vector<AliasTable> _conditional;
+    };
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace raytracer
+{
+    // branch-free log2/exp2/pow approximations, relative error around 1e-6,
+    // written as plain arithmetic so loops over them vectorize
+    inline float FastLog2(float x)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &x, 4);
+        int e = (int)((bits >> 23) & 0xFF) - 127;
+        bits = (bits & 0x007FFFFF) | 0x3F800000;
+        float m;
+        std::memcpy(&m, &bits, 4);
+        // move mantissa to [sqrt(.5), sqrt(2)) so the series converges fast
+        bool high = m > 1.41421356f;
+        m = high ? m * 0.5f : m;
+        e += high;
+        float s = (m - 1.0f) / (m + 1.0f);
+        float s2 = s * s;
+        float p = s * (2.88539008f + s2 * (0.961796694f + s2 * (0.577078016f + s2 * 0.412198583f)));
+        return e + p;
+    }
+
+    inline float FastExp2(float x)
+    {
+        x = x < -126.0f ? -126.0f : (x > 126.0f ? 126.0f : x);
+        int i = (int)(x + (x < 0 ? -0.5f : 0.5f));
+        float f = (x - i) * 0.693147181f;
+        float p = 1.0f + f * (1.0f + f * (0.5f + f * (0.166666667f + f * (0.0416666667f + f * (0.00833333333f + f * 0.00138888889f)))));
+        uint32_t bits = (uint32_t)(i + 127) << 23;
+        float scale;
+        std::memcpy(&scale, &bits, 4);
+        return p * scale;
+    }
+
+    inline float FastPow(float a, float b)
+    {
+        if(b == 0)
+            return 1.0f;
+        return a > 0 ? FastExp2(b * FastLog2(a)) : 0.0f;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+namespace raytracer
+{
+    // IEEE 754 half precision conversions in plain integer math, rounding to
+    // nearest even; infinities and nans are kept
+
+    inline uint16_t FloatToHalf(float value)
+    {
+        uint32_t f;
+        std::memcpy(&f, &value, sizeof(f));
+        uint32_t sign = f & 0x80000000u;
+        f ^= sign;
+        uint16_t h;
+        if(f >= (127u + 16) << 23)
+        {
+            // too large for a half, or already inf or nan
+            h = f > 255u << 23 ? 0x7e00 : 0x7c00;
+        }
+        else if(f < 113u << 23)
+        {
+            // subnormal or zero, adding 0.5 lines the mantissa up with the half's
+            float v;
+            std::memcpy(&v, &f, sizeof(v));
+            v += 0.5f;
+            std::memcpy(&f, &v, sizeof(f));
+            h = f - (126u << 23);
+        }
+        else
+        {
+            uint32_t odd = (f >> 13) & 1;
+            f += ((15u - 127) << 23) + 0xfff + odd;
+            h = f >> 13;
+        }
+        return h | (sign >> 16);
+    }
+
+    inline float HalfToFloat(uint16_t h)
+    {
+        const uint32_t exponent = 0x7c00u << 13;
+        uint32_t f = (h & 0x7fffu) << 13;
+        uint32_t e = f & exponent;
+        f += (127u - 15) << 23;
+        if(e == exponent)
+        {
+            // inf or nan
+            f += (128u - 16) << 23;
+        }
+        else if(e == 0)
+        {
+            // subnormal or zero, renormalize
+            f += 1u << 23;
+            float v;
+            std::memcpy(&v, &f, sizeof(v));
+            v -= 6.103515625e-05f;
+            std::memcpy(&f, &v, sizeof(f));
+        }
+        f |= (uint32_t)(h & 0x8000u) << 16;
+        float value;
+        std::memcpy(&value, &f, sizeof(value));
+        return value;
+    }
+}
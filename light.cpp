@@ -1,5 +1,7 @@
 #include "light.h"
+#include "objectlight.h"
 #include <cfloat>
+#include <algorithm>
 
 namespace raytracer
 {
@@ -13,14 +15,81 @@ namespace raytracer
 
     }
 
+    float Light::SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal)
+    {
+        switch(Type)
+        {
+            case LightType::Point: return static_cast<PointLight*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            case LightType::Area: return static_cast<AreaLight*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            case LightType::Directional: return static_cast<DirectionalLight*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            case LightType::Spot: return static_cast<SpotLight*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            case LightType::Environment: return static_cast<EnvironmentLight*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            case LightType::Sphere: return static_cast<LightSphere*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            case LightType::Mesh: return static_cast<LightMesh*>(this)->SamplePoint(point, normal, sample, dir, lnormal);
+            default: return 0;
+        }
+    }
+
+    Vector3f Light::GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample)
+    {
+        switch(Type)
+        {
+            case LightType::Point: return static_cast<PointLight*>(this)->GetLuminance(point, normal, lsample);
+            case LightType::Area: return static_cast<AreaLight*>(this)->GetLuminance(point, normal, lsample);
+            case LightType::Directional: return static_cast<DirectionalLight*>(this)->GetLuminance(point, normal, lsample);
+            case LightType::Spot: return static_cast<SpotLight*>(this)->GetLuminance(point, normal, lsample);
+            case LightType::Environment: return static_cast<EnvironmentLight*>(this)->GetLuminance(point, normal, lsample);
+            case LightType::Sphere: return static_cast<LightSphere*>(this)->GetLuminance(point, normal, lsample);
+            case LightType::Mesh: return static_cast<LightMesh*>(this)->GetLuminance(point, normal, lsample);
+            default: return Vector3f::Zero();
+        }
+    }
+
+    float Light::Power(float sceneRadius)
+    {
+        switch(Type)
+        {
+            case LightType::Point: return static_cast<PointLight*>(this)->Power(sceneRadius);
+            case LightType::Area: return static_cast<AreaLight*>(this)->Power(sceneRadius);
+            case LightType::Directional: return static_cast<DirectionalLight*>(this)->Power(sceneRadius);
+            case LightType::Spot: return static_cast<SpotLight*>(this)->Power(sceneRadius);
+            case LightType::Environment: return static_cast<EnvironmentLight*>(this)->Power(sceneRadius);
+            case LightType::Sphere: return static_cast<LightSphere*>(this)->Power(sceneRadius);
+            case LightType::Mesh: return static_cast<LightMesh*>(this)->Power(sceneRadius);
+            default: return 0;
+        }
+    }
+
+    float Light::SamplePdf(Vector3f point, Vector3f lsample, Vector3f lnormal)
+    {
+        switch(Type)
+        {
+            case LightType::Sphere: return static_cast<LightSphere*>(this)->SamplePdf(point, lsample, lnormal);
+            case LightType::Mesh: return static_cast<LightMesh*>(this)->SamplePdf(point, lsample, lnormal);
+            default: return 0;
+        }
+    }
+
+    Vector3f Light::Emitted()
+    {
+        switch(Type)
+        {
+            case LightType::Sphere: return static_cast<LightSphere*>(this)->Emitted();
+            case LightType::Mesh: return static_cast<LightMesh*>(this)->Emitted();
+            default: return Vector3f::Zero();
+        }
+    }
+
     PointLight::PointLight(pugi::xml_node node) : Light(node)
     {
+        Type = LightType::Point;
         Position = Vec3fFrom(node.child("Position"));
         Intensity = Vec3fFrom(node.child("Intensity"));
     }
 
     AreaLight::AreaLight(pugi::xml_node node) : Light(node)
     {
+        Type = LightType::Area;
         Position = Vec3fFrom(node.child("Position"));
         Normal = Vec3fFrom(node.child("Normal"));
         Radiance = Vec3fFrom(node.child("Radiance"));
@@ -35,31 +104,18 @@ namespace raytracer
         np.normalize();
         u = np.cross(Normal).normalized();
         v = Normal.cross(u).normalized();
-
-
-        int k = 0;
-        rndX.resize(100);
-        rndY.resize(100);
-        for(int i = 0; i < 10; i++)
-        {
-            for(int j = 0; j < 10; j++)
-            {
-                rndX[k] = rnd(generator) + i;
-                rndY[k] = rnd(generator) + j;
-                k++;
-            }
-        }
-        c = 0;
     }
 
     DirectionalLight::DirectionalLight(pugi::xml_node node) : Light(node)
     {
+        Type = LightType::Directional;
         Direction = Vec3fFrom(node.child("Direction")).normalized();
         Radiance = Vec3fFrom(node.child("Radiance"));
     }
 
     SpotLight::SpotLight(pugi::xml_node node) : Light(node)
     {
+        Type = LightType::Spot;
         Position = Vec3fFrom(node.child("Position"));
         Direction = Vec3fFrom(node.child("Direction")).normalized();
         Intensity = Vec3fFrom(node.child("Intensity"));
@@ -69,10 +125,30 @@ namespace raytracer
 
     EnvironmentLight::EnvironmentLight(pugi::xml_node node) : Light(node)
     {
+        Type = LightType::Environment;
         int imgId = node.child("ImageId").text().as_int();
         _hdr = ResourceLocator::GetInstance().GetImage(imgId);
     }
 
+    void EnvironmentLight::BuildDistribution()
+    {
+        _hdr->Load();
+        // GetColor maps [0,1] onto pixel 0..size-1, so cell (x, y) of the
+        // distribution shows pixel (x, y); rows are weighted by sin(theta)
+        int w = std::max(1, (int)_hdr->Width - 1);
+        int h = std::max(1, (int)_hdr->Height - 1);
+        std::vector<float> weights(w * h);
+        for(int y = 0; y < h; y++)
+        {
+            float sintheta = std::sin(M_PI * (y + .5f) / h);
+            for(int x = 0; x < w; x++)
+            {
+                weights[y * w + x] = Luminance(_hdr->Fetch(x, y)) * sintheta;
+            }
+        }
+        _distribution = Distribution2D(weights, w, h);
+    }
+
     float PointLight::SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal)
     {
         sample = Position;
@@ -84,11 +160,8 @@ namespace raytracer
 
     float AreaLight::SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal)
     {
-        float r1 = rndX[c % 100] / 10 - .5f;
-        float r2 = rndY[c % 100] / 10 - .5f;
-        c++;
-        //float r1 = rnd(generator) - .5f;
-        //float r2 = rnd(generator) - .5f;
+        float r1 = rnd(Random::Thread()) - .5f;
+        float r2 = rnd(Random::Thread()) - .5f;
         sample = Position + Size * (u * (r1) + v * (r2));
         dir = sample - point;
         float r = dir.norm();
@@ -112,20 +185,27 @@ namespace raytracer
 
     float EnvironmentLight::SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal)
     {
-        // random reject sampling
-        while(true)
-        {
-            float x = rnd(generator) * 2 - 1;
-            float y = rnd(generator) * 2 - 1;
-            float z = rnd(generator) * 2 - 1;
-            Vector3f candid = Vector3f(x, y, z);
-            if(candid.norm() <= 1 && normal.dot(candid) > 0)
-            {
-                sample = candid.normalized();
-                dir = sample;
-                return FLT_MAX;
-            }
-        }
+        // importance sample the map, directions below the surface are left to the caller
+        auto& rng = Random::Thread();
+        float u, v, pdf;
+        _distribution.Sample(rng.Uniform(), rng.Uniform(), rng.Uniform(), rng.Uniform(), u, v, pdf);
+        float theta = v * M_PI;
+        float phi = M_PI - 2 * M_PI * u;
+        sample = Vector3f(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+        dir = sample;
+        return FLT_MAX;
+    }
+
+    float EnvironmentLight::Pdf(Vector3f direction)
+    {
+        float phi = std::atan2(direction.z(), direction.x());
+        float theta = std::acos(std::clamp(direction.y(), -1.0f, 1.0f));
+        float sintheta = std::sin(theta);
+        if(sintheta <= 0)
+            return 0;
+        float u = (-phi + M_PI) / (2 * M_PI);
+        float v = theta / M_PI;
+        return _distribution.Pdf(u, v) / (2 * M_PI * M_PI * sintheta);
     }
 
     Vector3f PointLight::GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample)
@@ -170,7 +250,45 @@ namespace raytracer
 
     Vector3f EnvironmentLight::GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample)
     {
-        return GetColor(lsample) * 2 * M_PI;
+        float pdf = Pdf(lsample);
+        if(pdf <= 0)
+            return Vector3f::Zero();
+        return GetColor(lsample) / pdf;
+    }
+
+    float PointLight::Power(float sceneRadius)
+    {
+        return 4 * M_PI * Luminance(Intensity);
+    }
+
+    float AreaLight::Power(float sceneRadius)
+    {
+        // emits on both sides
+        return 2 * M_PI * Size * Size * Luminance(Radiance);
+    }
+
+    float DirectionalLight::Power(float sceneRadius)
+    {
+        return M_PI * sceneRadius * sceneRadius * Luminance(Radiance);
+    }
+
+    float SpotLight::Power(float sceneRadius)
+    {
+        return 2 * M_PI * (1 - std::cos(CoverageAngle * M_PI / 360)) * Luminance(Intensity);
+    }
+
+    float EnvironmentLight::Power(float sceneRadius)
+    {
+        float sum = 0;
+        for(int y = 0; y < (int)_hdr->Height; y++)
+        {
+            for(int x = 0; x < (int)_hdr->Width; x++)
+            {
+                sum += Luminance(_hdr->Fetch(x, y));
+            }
+        }
+        float avg = sum / (_hdr->Width * _hdr->Height);
+        return M_PI * sceneRadius * sceneRadius * M_PI * avg;
     }
 
     Vector3f EnvironmentLight::GetColor(Vector3f direction)
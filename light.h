@@ -5,6 +5,8 @@
 #include "vecfrom.h"
 #include "texture.h"
 #include "resourcelocator.h"
+#include "rng.h"
+#include "distribution.h"
 
 using namespace Eigen;
 
@@ -18,18 +20,29 @@ namespace raytracer
             Vector3f Intensity;
     };
 
+    class Object;
+
+    enum class LightType : unsigned char
+    {
+        Point, Area, Directional, Spot, Environment, Sphere, Mesh
+    };
+
     class Light
     {
         public:
             Light(pugi::xml_node node);
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal)
-            {
-                return 0;
-            }
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample)
-            {
-                return Vector3f::Zero();
-            }
+            LightType Type;
+            // the scene object for lights rays can hit, nullptr otherwise
+            Object* Shape = nullptr;
+            // these switch on Type and call the concrete light, no virtual call
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            // rough emitted power, used to pick lights proportionally
+            float Power(float sceneRadius);
+            // solid angle pdf of SamplePoint returning lsample, zero for lights rays can not hit
+            float SamplePdf(Vector3f point, Vector3f lsample, Vector3f lnormal);
+            // radiance seen by rays hitting the light, zero for lights rays can not hit
+            Vector3f Emitted();
     };
 
     class PointLight : public Light
@@ -38,8 +51,9 @@ namespace raytracer
             PointLight(pugi::xml_node node);
             Vector3f Position;          
             Vector3f Intensity;
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
     };
 
     class AreaLight : public Light
@@ -50,15 +64,12 @@ namespace raytracer
             Vector3f Normal;
             Vector3f Radiance;
             float Size;
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
         private:
             Vector3f u, v;
-            std::default_random_engine generator;
             std::uniform_real_distribution<float> rnd;
-            std::vector<float> rndX;
-            std::vector<float> rndY;
-            int c;
     };
 
     class DirectionalLight : public Light
@@ -67,8 +78,9 @@ namespace raytracer
             DirectionalLight(pugi::xml_node node);
             Vector3f Direction;
             Vector3f Radiance;
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
     };
 
     class SpotLight : public Light
@@ -80,20 +92,26 @@ namespace raytracer
             Vector3f Intensity;
             float CoverageAngle;
             float FalloffAngle;
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
     };
 
     class EnvironmentLight : public Light
     {
         public:
             EnvironmentLight(pugi::xml_node node);
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
+            // importance sampling table over the image, built once the scene's
+            // image decodes are done, a texture sharing the image may still be
+            // building its mips until then
+            void BuildDistribution();
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
             Vector3f GetColor(Vector3f direction);
+            float Pdf(Vector3f direction);
         private:
             Image* _hdr;
-            std::default_random_engine generator;
-            std::uniform_real_distribution<float> rnd;
+            Distribution2D _distribution;
     };
 }
\ No newline at end of file
@@ -1,39 +1,116 @@
 #include "pugixml.hpp"
 #include "scene.h"
+#include "distributed.h"
+#include "binaryscene.h"
 #include <iostream>
 #include <chrono>
 #include <stdlib.h>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <unistd.h>
 
 using namespace raytracer;
 
 int main(int argc, char *argv[])
 {
     int numThreads = 1;
-    if(argc > 2)
+    bool resume = false;
+    int workers = 0;
+    int tileSize = 64;
+    int tileTimeout = 600;
+    std::string workerSocket;
+    const char* convertPath = nullptr;
+    std::string socketPath = "/tmp/raytracer-" + std::to_string(getpid()) + ".sock";
+    std::vector<char*> args;
+    for(int i = 1; i < argc; i++)
     {
-        numThreads = std::atoi(argv[2]);
+        if(std::strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if(std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+            workers = std::atoi(argv[++i]);
+        else if(std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc)
+            tileSize = std::max(1, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--tile-timeout") == 0 && i + 1 < argc)
+            tileTimeout = std::max(1, std::atoi(argv[++i]));
+        else if(std::strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+            socketPath = argv[++i];
+        else if(std::strcmp(argv[i], "--worker") == 0 && i + 1 < argc)
+            workerSocket = argv[++i];
+        else if(std::strcmp(argv[i], "--convert") == 0 && i + 1 < argc)
+            convertPath = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+    if(args.empty())
+    {
+        std::cout << "usage: " << argv[0] << " scene.xml [threadNum] [--resume]"
+            << " [--workers N [--tile size] [--tile-timeout seconds] [--socket path]] [--worker socket]"
+            << " [--convert out.rtscene]" << std::endl;
+        return 1;
+    }
+    if(convertPath != nullptr)
+    {
+        return BinaryScene::Convert(args[0], convertPath) ? 0 : 1;
+    }
+    if(args.size() > 1)
+    {
+        numThreads = std::atoi(args[1]);
     }
     pugi::xml_document doc;
     auto start = std::chrono::high_resolution_clock::now();
-    doc.load_file(argv[1]);
+    std::unique_ptr<BinaryScene> binary;
+    if(BinaryScene::IsBinary(args[0]))
+    {
+        binary.reset(new BinaryScene(args[0]));
+        if(!binary->Valid())
+        {
+            std::cerr << "cannot load " << args[0] << std::endl;
+            return 1;
+        }
+        doc.load_buffer(binary->Xml(), binary->XmlSize());
+    }
+    else
+    {
+        doc.load_file(args[0]);
+    }
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     std::cout << "pugiload: " << duration.count() << " ms" << std::endl;
 
     start = std::chrono::high_resolution_clock::now();
-    auto scene = Scene(doc.child("Scene"));
+    auto scene = Scene(doc.child("Scene"), binary.get());
     stop = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     std::cout << "parsing" << duration.count() << " ms" << std::endl;
 
     start = std::chrono::high_resolution_clock::now();
     scene.Load();
+    scene.Resume = resume;
     stop = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     std::cout << "bvh " << duration.count() << " ms" << std::endl;
 
+    if(!workerSocket.empty())
+    {
+        return RunWorker(scene, workerSocket, numThreads);
+    }
+
     start = std::chrono::high_resolution_clock::now();
-    scene.Render(numThreads);
+    if(workers > 0)
+    {
+        Coordinator coordinator(scene, socketPath, tileSize, tileTimeout);
+        int threads = std::max(1u, std::thread::hardware_concurrency() / workers);
+        coordinator.Spawn({argv[0], args[0], std::to_string(threads), "--worker", socketPath}, workers);
+        coordinator.Render();
+    }
+    else
+    {
+        scene.Render(numThreads);
+    }
     stop = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
     std::cout << "render" << duration.count() << " ms" << std::endl;
@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace raytracer
+{
+    // read-only mapping of a whole file, Data() is null if it cannot be opened
+    class MappedFile
+    {
+        public:
+            MappedFile(const char* path)
+            {
+                int fd = open(path, O_RDONLY);
+                if(fd < 0)
+                    return;
+                struct stat st;
+                if(fstat(fd, &st) == 0 && st.st_size > 0)
+                {
+                    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if(data != MAP_FAILED)
+                    {
+                        _data = static_cast<const unsigned char*>(data);
+                        _size = st.st_size;
+                    }
+                }
+                close(fd);
+            }
+
+            ~MappedFile()
+            {
+                Close();
+            }
+
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+            const unsigned char* Data() const { return _data; }
+            size_t Size() const { return _size; }
+
+            void Close()
+            {
+                if(_data != nullptr)
+                    munmap(const_cast<unsigned char*>(_data), _size);
+                _data = nullptr;
+                _size = 0;
+            }
+        private:
+            const unsigned char* _data = nullptr;
+            size_t _size = 0;
+    };
+}
@@ -1,5 +1,6 @@
 #include "material.h"
 #include <iostream>
+#include <cfloat>
 #include "scene.h"
 #include "ray.h"
 #include "object.h"
@@ -7,7 +8,11 @@
 namespace raytracer
 {
 
-    Material::Material(){}
+    Material::Material()
+    {
+        AmbientReflectance = DiffuseReflectance = SpecularReflectance = Vector3f::Zero();
+        Compile({});
+    }
 
     Material::Material(pugi::xml_node node)
     {
@@ -38,18 +43,67 @@ namespace raytracer
             Type = 0;
         }        
 
-        int brdf = node.attribute("BRDF").as_int(-1);
-        if(brdf != -1)
+        _brdf.N = RefractionIndex;
+        _brdf.N2K2 = RefractionIndex * RefractionIndex + AbsorptionIndex * AbsorptionIndex;
+        int id = node.attribute("BRDF").as_int(-1);
+        BRDF* brdf = id != -1 ? ResourceLocator::GetInstance().GetBRDF(id) : nullptr;
+        if(brdf == nullptr)
         {
-            Brdf = ResourceLocator::GetInstance().GetBRDF(brdf);
+            _brdfType = BRDFType::OriginalBlinnPhong;
+            _brdf.Exponent = PhongExponent;
+            return;
         }
-        else
+        _brdfType = brdf->Type;
+        _brdf.Exponent = brdf->Exponent;
+        float e = brdf->Exponent;
+        if(brdf->Type == BRDFType::ModifiedPhong && static_cast<ModifiedPhong*>(brdf)->Normalized)
+        {
+            _brdf.DiffuseScale = M_1_PI;
+            _brdf.SpecularScale = (e + 2) / (2 * M_PI);
+        }
+        else if(brdf->Type == BRDFType::ModifiedBlinnPhong && static_cast<ModifiedBlinnPhong*>(brdf)->Normalized)
+        {
+            _brdf.DiffuseScale = M_1_PI;
+            _brdf.SpecularScale = (e + 8) / (8 * M_PI);
+        }
+        else if(brdf->Type == BRDFType::TorranceSparrow)
+        {
+            _brdf.BlinnScale = (e + 2) / (2 * M_PI);
+            _brdf.Kdfresnel = static_cast<TorranceSparrow*>(brdf)->Kdfresnel;
+        }
+    }
+
+    void Material::Compile(const std::vector<float>& gammas, bool fast)
+    {
+        _brdf.FresnelTable.clear();
+        _brdf.PowTable.clear();
+        for(int i = 0; fast && i < BRDFConstants::FresnelTableSize; i++)
+            _brdf.FresnelTable.push_back(_brdf.ExactFresnel((float)i / (BRDFConstants::FresnelTableSize - 1)));
+        if(fast && _brdf.Exponent >= 2)
         {
-            Brdf = new OriginalBlinnPhong();
-            Brdf->Exponent = PhongExponent;
+            _brdf.PowScale = _brdf.Exponent * (BRDFConstants::PowTableSize - 1) / BRDFConstants::PowTableReach;
+            for(int i = 0; i < BRDFConstants::PowTableSize - 1; i++)
+                _brdf.PowTable.push_back(std::pow(std::max(1 - i / (double)_brdf.PowScale, 0.0), (double)_brdf.Exponent));
+            _brdf.PowTable.push_back(0);
+        }
+        _reflectances.clear();
+        for(float gamma: gammas)
+        {
+            // cameras sharing a gamma share the work
+            auto same = std::find_if(_reflectances.begin(), _reflectances.end(),
+                [gamma](const Reflectances& r) { return r.Gamma == gamma; });
+            if(same != _reflectances.end())
+            {
+                _reflectances.push_back(*same);
+                continue;
+            }
+            Reflectances r;
+            r.Gamma = gamma;
+            r.Ka = Degamma ? Vec3Pow(AmbientReflectance, gamma) : AmbientReflectance;
+            r.Kd = Degamma ? Vec3Pow(DiffuseReflectance, gamma) : DiffuseReflectance;
+            r.Ks = Degamma ? Vec3Pow(SpecularReflectance, gamma) : SpecularReflectance;
+            _reflectances.push_back(r);
         }
-        Brdf->n = RefractionIndex;
-        Brdf->k = AbsorptionIndex;
     }
 
     std::ostream& operator<<(std::ostream& os, const Material& mat)
@@ -63,93 +117,91 @@ namespace raytracer
         return os;
     }
 
-    Vector3f Material::Shade(Scene& scene, Ray& ray, RayHit& hit, float gamma)
+    BRDF::BRDF() {}
+
+    BRDF::BRDF(pugi::xml_node node)
     {
-        Vector3f color = Vector3f::Zero();
-        SamplerData data;
-        data.point = hit.Point;
-        data.u = hit.u;
-        data.v = hit.v;
-        if(hit.Texture != nullptr && hit.Texture->Mode == DecalMode::REPLACE_ALL)
-        {
-            return hit.Texture->Color(data);
-        }
-        Vector3f ka = AmbientReflectance;
-        Vector3f kd = DiffuseReflectance;
-        Vector3f ks = SpecularReflectance;
-        if(Degamma)
-        {
-            ka = Vec3Pow(ka, gamma);
-            kd = Vec3Pow(kd, gamma);
-            ks = Vec3Pow(ks, gamma);
-        }
-        if(hit.Texture != nullptr)
-        {
-            if(hit.Texture->Mode == DecalMode::REPLACE_KD)
-            {                        
-                kd = hit.Texture->Color(data);
-            }
-            else if(hit.Texture->Mode == DecalMode::BLEND_KD)
-            {
-                kd = (kd + hit.Texture->Color(data)) / 2;
-            }
-        }            
-        color += ka.cwiseProduct(scene.ambientLight.Intensity);
-        for(int l = 0; l < scene.Lights.size(); l++)
-        {
-            auto light = scene.Lights[l];                    
-            Vector3f sp = hit.Point + hit.Normal * scene.ShadowRayEpsilon;
-            Vector3f lsample;
-            Vector3f ldir;
-            Vector3f lnormal;
-            float r = light->SamplePoint(sp, hit.Normal, lsample, ldir, lnormal);
-            // SHADOW CHECK                
-            Ray sRay = Ray(sp, ldir, ray.Time);                
-            auto obj = dynamic_cast<Object*>(light);
-            if(obj != nullptr)
-                sRay.Ignore = obj->Id;
-            else
-                sRay.Ignore = -1;
-            RayHit sHit;
-            bool sf = scene.RayCast(sRay, sHit, r, false);
-            if(sf && sHit.T < r)
-                continue;
+        Exponent = node.child("Exponent").text().as_float();
+    }
 
-            auto viewDir = (ray.Origin - hit.Point).normalized();
-            auto lum = light->GetLuminance(hit.Point, lnormal, lsample);
-            color += Brdf->Shade(kd, ks, ldir, hit.Normal, viewDir, lum);
-        }
-        return color;
+    static float SpecularChance(Vector3f kd, Vector3f ks)
+    {
+        float d = Luminance(kd);
+        float s = Luminance(ks);
+        if(d + s <= 0)
+            return 0.5f;
+        return s / (d + s);
     }
 
+    // blinn half vector lobe, also the microfacet distribution of TorranceSparrow
+    static Vector3f SampleBlinnLobe(float exponent, Vector3f normal, Vector3f viewDir, float r1, float r2)
+    {
+        Vector3f h = PowerCosineSample(normal, exponent, r1, r2);
+        return h * 2 * viewDir.dot(h) - viewDir;
+    }
 
-    BRDF::BRDF() {}
+    static float BlinnLobePdf(const BRDFConstants& c, Vector3f lightDir, Vector3f normal, Vector3f viewDir)
+    {
+        Vector3f h = (lightDir + viewDir).normalized();
+        float cosh = h.dot(normal);
+        float vdoth = viewDir.dot(h);
+        if(cosh <= 0 || vdoth <= 0)
+            return 0;
+        return (c.Exponent + 1) * c.Pow(cosh) / (2 * M_PI * 4 * vdoth);
+    }
 
-    BRDF::BRDF(pugi::xml_node node)
+    // phong lobe is centered on the mirror direction of the viewer
+    static Vector3f SamplePhongLobe(float exponent, Vector3f normal, Vector3f viewDir, float r1, float r2)
     {
-        Exponent = node.child("Exponent").text().as_float();
+        Vector3f r = normal * 2 * viewDir.dot(normal) - viewDir;
+        return PowerCosineSample(r, exponent, r1, r2);
     }
 
-    OriginalPhong::OriginalPhong(pugi::xml_node node) : BRDF(node) {}
+    static float PhongLobePdf(const BRDFConstants& c, Vector3f lightDir, Vector3f normal, Vector3f viewDir)
+    {
+        Vector3f r = normal * 2 * viewDir.dot(normal) - viewDir;
+        float cosr = lightDir.dot(r);
+        if(cosr <= 0)
+            return 0;
+        return (c.Exponent + 1) * c.Pow(cosr) / (2 * M_PI);
+    }
+
+    OriginalPhong::OriginalPhong(pugi::xml_node node) : BRDF(node)
+    {
+        Type = BRDFType::OriginalPhong;
+    }
 
     ModifiedPhong::ModifiedPhong(pugi::xml_node node) : BRDF(node) 
     {
+        Type = BRDFType::ModifiedPhong;
         Normalized = node.attribute("normalized").as_bool(false);
     }
 
-    OriginalBlinnPhong::OriginalBlinnPhong(pugi::xml_node node) : BRDF(node) {}
+    OriginalBlinnPhong::OriginalBlinnPhong(pugi::xml_node node) : BRDF(node)
+    {
+        Type = BRDFType::OriginalBlinnPhong;
+    }
 
     ModifiedBlinnPhong::ModifiedBlinnPhong(pugi::xml_node node) : BRDF(node) 
     {
+        Type = BRDFType::ModifiedBlinnPhong;
         Normalized = node.attribute("normalized").as_bool(false);
     }
 
     TorranceSparrow::TorranceSparrow(pugi::xml_node node) : BRDF(node) 
     {
+        Type = BRDFType::TorranceSparrow;
         Kdfresnel = node.attribute("kdfresnel").as_bool(false);
     }
 
-    Vector3f OriginalPhong::Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance)
+    // the brdfs specialized per type, the lobe's sampling and pdf follow the type too
+    template<BRDFType T>
+    static Vector3f ShadeBRDF(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks, const Vector3f& lightDir,
+        const Vector3f& normal, const Vector3f& viewDir, const Vector3f& luminance);
+
+    template<>
+    Vector3f ShadeBRDF<BRDFType::OriginalPhong>(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks,
+        const Vector3f& lightDir, const Vector3f& normal, const Vector3f& viewDir, const Vector3f& luminance)
     {
         Vector3f color = Vector3f::Zero();
         // DIFFUSE
@@ -160,32 +212,30 @@ namespace raytracer
         auto r = Reflect(lightDir, normal, 0);
         float cosar = r.dot(-viewDir);
         cosar = cosar < 0 ? 0 : cosar;
-        color += ks.cwiseProduct(luminance) * std::pow(cosar, Exponent);
+        color += ks.cwiseProduct(luminance) * c.Pow(cosar);
         return color;
     }
 
-    Vector3f ModifiedPhong::Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance)
+    template<>
+    Vector3f ShadeBRDF<BRDFType::ModifiedPhong>(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks,
+        const Vector3f& lightDir, const Vector3f& normal, const Vector3f& viewDir, const Vector3f& luminance)
     {
         Vector3f color = Vector3f::Zero();
         // DIFFUSE
         float teta = lightDir.dot(normal);        
         teta = teta < 0 ? 0 : teta;
-        if(Normalized)
-            color += kd.cwiseProduct(luminance) * teta / M_PI;
-        else
-            color += kd.cwiseProduct(luminance) * teta;                            
+        color += kd.cwiseProduct(luminance) * teta * c.DiffuseScale;
         // SPECULAR
         auto r = Reflect(lightDir, normal, 0);
         float cosar = r.dot(-viewDir);
         cosar = cosar < 0 ? 0 : cosar;
-        if(Normalized)
-            color += ks.cwiseProduct(luminance) * std::pow(cosar, Exponent) * teta * ((Exponent + 2) / (2 * M_PI));
-        else        
-            color += ks.cwiseProduct(luminance) * std::pow(cosar, Exponent) * teta;
+        color += ks.cwiseProduct(luminance) * c.Pow(cosar) * teta * c.SpecularScale;
         return color;
     }
 
-    Vector3f OriginalBlinnPhong::Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance)
+    template<>
+    Vector3f ShadeBRDF<BRDFType::OriginalBlinnPhong>(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks,
+        const Vector3f& lightDir, const Vector3f& normal, const Vector3f& viewDir, const Vector3f& luminance)
     {
         Vector3f color = Vector3f::Zero();
         // DIFFUSE
@@ -196,70 +246,245 @@ namespace raytracer
         Vector3f h = (lightDir + viewDir).normalized();
         teta = h.dot(normal);
         teta = teta < 0 ? 0 : teta;
-        teta = std::pow(teta, Exponent);
+        teta = c.Pow(teta);
         color += ks.cwiseProduct(luminance) * teta;
         return color;
     }
 
-    Vector3f ModifiedBlinnPhong::Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance)
+    template<>
+    Vector3f ShadeBRDF<BRDFType::ModifiedBlinnPhong>(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks,
+        const Vector3f& lightDir, const Vector3f& normal, const Vector3f& viewDir, const Vector3f& luminance)
     {
         Vector3f color = Vector3f::Zero();
         // DIFFUSE
         float teta = lightDir.dot(normal);
         teta = teta < 0 ? 0 : teta;
-        if(Normalized)
-            color += kd.cwiseProduct(luminance) * teta / M_PI;                            
-        else
-            color += kd.cwiseProduct(luminance) * teta;                            
+        color += kd.cwiseProduct(luminance) * teta * c.DiffuseScale;
         // SPECULAR
         Vector3f h = (lightDir + viewDir).normalized();
         float phi = h.dot(normal);
         phi = phi < 0 ? 0 : phi;
-        phi = std::pow(phi, Exponent);
-        if(Normalized)
-            color += ks.cwiseProduct(luminance) * teta * phi * ((Exponent+8)/(8*M_PI));
-        else
-            color += ks.cwiseProduct(luminance) * teta * phi;
+        phi = c.Pow(phi);
+        color += ks.cwiseProduct(luminance) * teta * phi * c.SpecularScale;
         return color;
     }
 
-    Vector3f TorranceSparrow::Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance)
+    template<>
+    Vector3f ShadeBRDF<BRDFType::TorranceSparrow>(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks,
+        const Vector3f& lightDir, const Vector3f& normal, const Vector3f& viewDir, const Vector3f& luminance)
     {
-        Vector3f color = Vector3f::Zero();
         float NdotL = std::max(0.f, normal.dot(lightDir));
-        float Rs = 0.0;
-        if (NdotL > 0) 
+        if(NdotL <= 0)
+            return Vector3f::Zero();
+        auto H = (lightDir + viewDir).normalized();
+        float NdotH = std::max(0.f, normal.dot(H));
+        float NdotV = std::max(0.f, normal.dot(viewDir));
+        float VdotH = std::max(0.f, lightDir.dot(H));
+
+        // Fresnel reflectance
+        float F = c.Fresnel(NdotV);
+
+        // Microfacet distribution by Blinn
+        float D = c.BlinnScale * c.Pow(NdotH);
+
+        // Geometric shadowing
+        float two_NdotH = 2.0 * NdotH;
+        float g1 = (two_NdotH * NdotV) / VdotH;
+        float g2 = (two_NdotH * NdotL) / VdotH;
+        float G = std::min(1.0f, std::min(g1, g2));
+
+        float Rs = (F * D * G) / (4 * NdotL * NdotV);
+        float kdf = c.Kdfresnel ? (1 - F) : 1;
+        return kd.cwiseProduct(luminance) * NdotL * M_1_PI * kdf  + ks.cwiseProduct(luminance) * NdotL * Rs;
+    }
+
+    template<BRDFType T>
+    static constexpr bool PhongLobe()
+    {
+        return T == BRDFType::OriginalPhong || T == BRDFType::ModifiedPhong;
+    }
+
+    // picks the diffuse or specular lobe by reflectance, then samples it
+    template<BRDFType T>
+    static Vector3f SampleBRDF(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks, const Vector3f& normal,
+        const Vector3f& viewDir, float r0, float r1, float r2)
+    {
+        if(r0 >= SpecularChance(kd, ks))
+            return CosineSampleHemisphere(normal, r1, r2);
+        if(PhongLobe<T>())
+            return SamplePhongLobe(c.Exponent, normal, viewDir, r1, r2);
+        return SampleBlinnLobe(c.Exponent, normal, viewDir, r1, r2);
+    }
+
+    template<BRDFType T>
+    static float BRDFPdf(const BRDFConstants& c, const Vector3f& kd, const Vector3f& ks, const Vector3f& lightDir,
+        const Vector3f& normal, const Vector3f& viewDir)
+    {
+        float cosl = lightDir.dot(normal);
+        if(cosl <= 0)
+            return 0;
+        float ps = SpecularChance(kd, ks);
+        float lobe;
+        if(PhongLobe<T>())
+            lobe = PhongLobePdf(c, lightDir, normal, viewDir);
+        else
+            lobe = BlinnLobePdf(c, lightDir, normal, viewDir);
+        return (1 - ps) * cosl * M_1_PI + ps * lobe;
+    }
+
+    template<BRDFType T>
+    Vector3f Material::shade(Scene& scene, Ray& ray, RayHit& hit, const Vector3f& ka, const Vector3f& kdm,
+        const Vector3f& ks) const
+    {
+        Vector3f color = Vector3f::Zero();
+        Vector3f kd = kdm;
+        if(hit.Texture != nullptr)
+        {
+            SamplerData data;
+            data.point = hit.Point;
+            data.u = hit.u;
+            data.v = hit.v;
+            data.dudx = hit.dudx;
+            data.dvdx = hit.dvdx;
+            data.dudy = hit.dudy;
+            data.dvdy = hit.dvdy;
+            if(hit.Texture->Mode == DecalMode::REPLACE_KD)
+            {                        
+                kd = hit.Texture->Color(data);
+            }
+            else if(hit.Texture->Mode == DecalMode::BLEND_KD)
+            {
+                kd = (kd + hit.Texture->Color(data)) / 2;
+            }
+        }            
+        color += ka.cwiseProduct(scene.ambientLight.Intensity);
+        auto viewDir = (ray.Origin - hit.Point).normalized();
+        Vector3f sp = hit.Point + hit.Normal * scene.ShadowRayEpsilon;
+        auto shadeEnvironment = [&](EnvironmentLight* env) -> Vector3f
+        {
+            // env map and brdf sampling, combined with the power heuristic
+            Vector3f lsample, ldir, lnormal;
+            Vector3f ret = Vector3f::Zero();
+            auto visible = [&](Vector3f dir)
+            {
+                Ray sRay = Ray(sp, dir, ray.Time);
+                RayHit sHit;
+                return !scene.RayCast(sRay, sHit, FLT_MAX, false);
+            };
+            env->SamplePoint(sp, hit.Normal, lsample, ldir, lnormal);
+            float pdfl = env->Pdf(ldir);
+            if(ldir.dot(hit.Normal) > 0 && pdfl > 0 && visible(ldir))
+            {
+                float w = PowerHeuristic(pdfl, BRDFPdf<T>(_brdf, kd, ks, ldir, hit.Normal, viewDir));
+                ret += ShadeBRDF<T>(_brdf, kd, ks, ldir, hit.Normal, viewDir, env->GetColor(ldir) * (w / pdfl));
+            }
+            auto& rng = Random::Thread();
+            Vector3f bdir = SampleBRDF<T>(_brdf, kd, ks, hit.Normal, viewDir, rng.Uniform(), rng.Uniform(), rng.Uniform());
+            float pdfb = BRDFPdf<T>(_brdf, kd, ks, bdir, hit.Normal, viewDir);
+            if(pdfb > 0 && visible(bdir))
+            {
+                float w = PowerHeuristic(pdfb, env->Pdf(bdir));
+                ret += ShadeBRDF<T>(_brdf, kd, ks, bdir, hit.Normal, viewDir, env->GetColor(bdir) * (w / pdfb));
+            }
+            return ret;
+        };
+        auto shadeLight = [&](Light* light) -> Vector3f
+        {
+            if(light->Type == LightType::Environment)
+                return shadeEnvironment(static_cast<EnvironmentLight*>(light));
+            Vector3f lsample;
+            Vector3f ldir;
+            Vector3f lnormal;
+            Vector3f ret = Vector3f::Zero();
+            float r = light->SamplePoint(sp, hit.Normal, lsample, ldir, lnormal);
+            // SHADOW CHECK                
+            Ray sRay = Ray(sp, ldir, ray.Time);                
+            auto obj = light->Shape;
+            if(obj != nullptr)
+                sRay.Ignore = obj->Id;
+            RayHit sHit;
+            bool sf = scene.RayCast(sRay, sHit, r, false);
+            bool lit = !(sf && sHit.T < r);
+            auto lum = lit ? light->GetLuminance(hit.Point, lnormal, lsample) : Vector3f::Zero();
+            if(obj == nullptr)
+                return lit ? ShadeBRDF<T>(_brdf, kd, ks, ldir, hit.Normal, viewDir, lum) : ret;
+
+            // object lights can also be found by sampling the brdf
+            if(lit)
+            {
+                float w = PowerHeuristic(light->SamplePdf(sp, lsample, lnormal), BRDFPdf<T>(_brdf, kd, ks, ldir, hit.Normal, viewDir));
+                ret += ShadeBRDF<T>(_brdf, kd, ks, ldir, hit.Normal, viewDir, lum * w);
+            }
+            auto& rng = Random::Thread();
+            Vector3f bdir = SampleBRDF<T>(_brdf, kd, ks, hit.Normal, viewDir, rng.Uniform(), rng.Uniform(), rng.Uniform());
+            float pdfb = BRDFPdf<T>(_brdf, kd, ks, bdir, hit.Normal, viewDir);
+            if(pdfb <= 0)
+                return ret;
+            Ray bRay = Ray(sp, bdir, ray.Time);
+            RayHit bHit;
+            if(scene.RayCast(bRay, bHit, FLT_MAX, true) && bHit.Object == obj)
+            {
+                float pdfl = light->SamplePdf(sp, bHit.Point, bHit.Normal);
+                if(pdfl > 0)
+                {
+                    float w = PowerHeuristic(pdfb, pdfl);
+                    ret += ShadeBRDF<T>(_brdf, kd, ks, bdir, hit.Normal, viewDir, light->Emitted() * (w / pdfb));
+                }
+            }
+            return ret;
+        };
+        int samples = scene.LightSamples;
+        if(samples <= 0 || samples >= (int)scene.Lights.size())
         {
-            auto H = (lightDir + viewDir).normalized();
-            float NdotH = std::max(0.f, normal.dot(H));
-            float NdotV = std::max(0.f, normal.dot(viewDir));
-            float VdotH = std::max(0.f, lightDir.dot(H));
-
-            // Fresnel reflectance
-            auto ndi = NdotV;
-            float rs = ((n*n + k*k) - 2 * n * ndi + ndi * ndi) / ((n*n + k*k) + 2 * n * ndi + ndi * ndi);
-            float rp = ((n*n + k*k) * ndi*ndi - 2*n*ndi + 1) / ((n*n + k*k) * ndi*ndi + 2*n*ndi + 1);
-            float F = (rs + rp) / 2;
-            
-            //float F0 = (n-1)/(n+1);
-            //F0 *= F0;
-            //float F = pow(1.0 - VdotH, 5.0);
-            //F *= (1.0 - F0);
-            //F += F0;
-
-            // Microfacet distribution by Blinn
-            float D = (Exponent + 2) * pow(NdotH, Exponent) / (2 * M_PI);
-
-            // Geometric shadowing
-            float two_NdotH = 2.0 * NdotH;
-            float g1 = (two_NdotH * NdotV) / VdotH;
-            float g2 = (two_NdotH * NdotL) / VdotH;
-            float G = std::min(1.0f, std::min(g1, g2));
-
-            Rs = (F * D * G) / (4 * NdotL * NdotV);
-            float kdf = Kdfresnel ? (1 - F) : 1;
-            return kd.cwiseProduct(luminance) * NdotL * M_1_PI * kdf  + ks.cwiseProduct(luminance) * NdotL * Rs;
+            for(int l = 0; l < (int)scene.Lights.size(); l++)
+            {
+                color += shadeLight(scene.Lights[l]);
+            }
+        }
+        else
+        {
+            // pick lights proportional to power, one shadow ray each
+            for(int s = 0; s < samples; s++)
+            {
+                float pdf;
+                int l = scene.LightDistribution.Sample(Random::Thread().Uniform(), pdf);
+                color += shadeLight(scene.Lights[l]) / (pdf * samples);
+            }
         }
         return color;
     }
-}
\ No newline at end of file
+
+    Vector3f Material::Shade(Scene& scene, Ray& ray, RayHit& hit, int camera) const
+    {
+        if(hit.Texture != nullptr && hit.Texture->Mode == DecalMode::REPLACE_ALL)
+        {
+            SamplerData data;
+            data.point = hit.Point;
+            data.u = hit.u;
+            data.v = hit.v;
+            data.dudx = hit.dudx;
+            data.dvdx = hit.dvdx;
+            data.dudy = hit.dudy;
+            data.dvdy = hit.dvdy;
+            return hit.Texture->Color(data);
+        }
+        auto& k = _reflectances[camera];
+        const Vector3f& ka = k.Ka;
+        const Vector3f& kd = k.Kd;
+        const Vector3f& ks = k.Ks;
+        switch(_brdfType)
+        {
+            case BRDFType::OriginalPhong:
+                return shade<BRDFType::OriginalPhong>(scene, ray, hit, ka, kd, ks);
+            case BRDFType::ModifiedPhong:
+                return shade<BRDFType::ModifiedPhong>(scene, ray, hit, ka, kd, ks);
+            case BRDFType::OriginalBlinnPhong:
+                return shade<BRDFType::OriginalBlinnPhong>(scene, ray, hit, ka, kd, ks);
+            case BRDFType::ModifiedBlinnPhong:
+                return shade<BRDFType::ModifiedBlinnPhong>(scene, ray, hit, ka, kd, ks);
+            case BRDFType::TorranceSparrow:
+                return shade<BRDFType::TorranceSparrow>(scene, ray, hit, ka, kd, ks);
+        }
+        return Vector3f::Zero();
+    }
+}
@@ -3,6 +3,9 @@
 #include "pugixml.hpp"
 #include "vecfrom.h"
 #include "resourcelocator.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 using namespace Eigen;
 
@@ -13,42 +16,118 @@ namespace raytracer
     class RayHit;
     class Scene;
 
+    enum class BRDFType : unsigned char
+    {
+        OriginalPhong, ModifiedPhong, OriginalBlinnPhong, ModifiedBlinnPhong, TorranceSparrow
+    };
+
+    // a brdf as the scene describes it, materials compile it into BRDFConstants
     class BRDF
     {
         public:
             BRDF();
             BRDF(pugi::xml_node node);
-            virtual Vector3f Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance) = 0;
+            BRDFType Type;
             float Exponent;
-            float n, k;
     };
 
-    class Material
+    // what a brdf needs at a shading point that doesn't change between points
+    struct BRDFConstants
+    {
+        static const int FresnelTableSize = 1024;
+        static const int PowTableSize = 1024;
+        // how far the pow table reaches from the peak, in (1 - x) * Exponent
+        static constexpr float PowTableReach = 12;
+        float Exponent;
+        // 1/pi and the lobe normalization when the brdf is normalized, else 1
+        float DiffuseScale = 1;
+        float SpecularScale = 1;
+        // torrance sparrow lobe normalization and whether fresnel dims the diffuse part
+        float BlinnScale = 1;
+        bool Kdfresnel = false;
+        // the material's refraction index and n^2 + k^2
+        float N = 0;
+        float N2K2 = 0;
+        // tables for fast shading, empty when shading is exact. FresnelTable holds
+        // fresnel at cos = i / (FresnelTableSize - 1), off by at most 4e-4 for n in
+        // [0.05, 5] and k in [0, 8]. PowTable holds x^Exponent at 1 - x = i / PowScale
+        // and 0 at its end, as x^Exponent < e^-12 past it; it is only built for
+        // exponents of 2 and up, where the lobe bends little enough between entries
+        // to keep it within 2e-5
+        std::vector<float> FresnelTable;
+        std::vector<float> PowTable;
+        float PowScale = 0;
+
+        // unpolarized fresnel reflectance of a conductor, cosi is the cosine to the normal
+        float ExactFresnel(float cosi) const
+        {
+            float rs = (N2K2 - 2 * N * cosi + cosi * cosi) / (N2K2 + 2 * N * cosi + cosi * cosi);
+            float rp = (N2K2 * cosi * cosi - 2 * N * cosi + 1) / (N2K2 * cosi * cosi + 2 * N * cosi + 1);
+            return (rs + rp) / 2;
+        }
+        float Fresnel(float cosi) const
+        {
+            if(FresnelTable.empty())
+                return ExactFresnel(cosi);
+            float x = std::min(std::max(cosi, 0.0f), 1.0f) * (FresnelTableSize - 1);
+            int i = std::min((int)x, FresnelTableSize - 2);
+            return FresnelTable[i] + (FresnelTable[i + 1] - FresnelTable[i]) * (x - i);
+        }
+        // x^Exponent for x in [0, 1]
+        float Pow(float x) const
+        {
+            if(PowTable.empty())
+                return std::pow(x, Exponent);
+            float t = std::min(std::max((1 - x) * PowScale, 0.0f), PowTableSize - 1.0f);
+            int i = std::min((int)t, PowTableSize - 2);
+            return PowTable[i] + (PowTable[i + 1] - PowTable[i]) * (t - i);
+        }
+    };
+
+    // Materials are compiled once the scene is read and stay immutable while
+    // rendering. A hit refers to its material by index into Scene::Materials.
+    class alignas(64) Material
     {
         public:
             Material();
             Material(pugi::xml_node node);
-            Vector3f Shade(Scene& scene, Ray& ray, RayHit& hit, float gamma);
+            // works out linear reflectances for the tonemap gamma of each camera,
+            // fast trades exact fresnel and lobe powers for tables
+            void Compile(const std::vector<float>& gammas, bool fast = false);
+            // shades for the camera at index camera of the gammas compiled for
+            Vector3f Shade(Scene& scene, Ray& ray, RayHit& hit, int camera) const;
+            float Fresnel(float cosi) const { return _brdf.Fresnel(cosi); }
             Vector3f AmbientReflectance;
             Vector3f DiffuseReflectance;
             Vector3f SpecularReflectance;
-            float PhongExponent;
-            Vector3f MirrorReflectance;
-            float RefractionIndex;
-            float AbsorptionIndex;
-            Vector3f AbsorptionCoefficient;
-            float Roughness;
-            bool Degamma;
-            int Type;
-            BRDF* Brdf;
+            float PhongExponent = 0;
+            Vector3f MirrorReflectance = Vector3f::Zero();
+            float RefractionIndex = 0;
+            float AbsorptionIndex = 0;
+            Vector3f AbsorptionCoefficient = Vector3f::Zero();
+            float Roughness = 0;
+            bool Degamma = false;
+            int Type = 0;
             friend std::ostream& operator<<(std::ostream& os, const Material& mat);            
+        private:
+            template<BRDFType T>
+            Vector3f shade(Scene& scene, Ray& ray, RayHit& hit, const Vector3f& ka, const Vector3f& kd, const Vector3f& ks) const;
+
+            BRDFType _brdfType = BRDFType::OriginalBlinnPhong;
+            BRDFConstants _brdf;
+            // reflectances after degamma, one set per camera
+            struct Reflectances
+            {
+                float Gamma;
+                Vector3f Ka, Kd, Ks;
+            };
+            std::vector<Reflectances> _reflectances;
     };
 
     class OriginalPhong : public BRDF
     {
         public:
             OriginalPhong(pugi::xml_node node);
-            virtual Vector3f Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance) override;
     };
 
     class ModifiedPhong : public BRDF
@@ -56,15 +135,13 @@ namespace raytracer
         public:
             ModifiedPhong(pugi::xml_node node);
             bool Normalized;
-            virtual Vector3f Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance) override;
     };
 
     class OriginalBlinnPhong : public BRDF
     {
         public:
-            OriginalBlinnPhong() {};
+            OriginalBlinnPhong() { Type = BRDFType::OriginalBlinnPhong; };
             OriginalBlinnPhong(pugi::xml_node node);
-            virtual Vector3f Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance) override;
     };
 
     class ModifiedBlinnPhong : public BRDF
@@ -72,7 +149,6 @@ namespace raytracer
         public:
             ModifiedBlinnPhong(pugi::xml_node node);
             bool Normalized;
-            virtual Vector3f Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance) override;
     };
 
     class TorranceSparrow : public BRDF
@@ -80,7 +156,6 @@ namespace raytracer
         public:
             TorranceSparrow(pugi::xml_node node);
             bool Kdfresnel;
-            virtual Vector3f Shade(Vector3f kd, Vector3f ks, Vector3f lightDir, Vector3f normal, Vector3f viewDir, Vector3f luminance) override;
     };
 
 
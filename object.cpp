@@ -1,10 +1,11 @@
 #include "object.h"
-#include <sstream>
 #include <cfloat>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include "scene.h"
-#include "plyLoader.h"
+#include "ply.h"
 
 namespace raytracer
 {
@@ -25,9 +26,7 @@ namespace raytracer
         _texIds[0] = _texIds[1] = 0;
         if(node.child("Textures"))
         {
-            std::stringstream ss;
-            ss << node.child("Textures").text().as_string();
-            ss >> _texIds[0] >> _texIds[1];
+            NumberReader(node.child("Textures").text().as_string()).Read(_texIds[0], _texIds[1]);
         }
     }
 
@@ -43,13 +42,13 @@ namespace raytracer
 
     void Object::Load(Scene& scene)
     {
-        _material = scene.Materials[MaterialId - 1];
+        // the last material is the scene's default, for objects without a valid one
+        _materialIndex = MaterialId >= 1 && MaterialId < (int)scene.Materials.size() ? MaterialId - 1 : scene.Materials.size() - 1;
         LocalToWorld = Transform<float, 3, Affine>::Identity();
-        std::stringstream ss;
-        ss << Transformations;
+        NumberReader reader(Transformations.c_str());
         char type;
         int id;
-        while(ss >> type >> id)
+        while(reader.Read(type, id))
         {
             if(type == 't')
             {
@@ -68,13 +67,15 @@ namespace raytracer
                 LocalToWorld = scene.Composite[id - 1];
             } 
         }
-        WorldToLocal = LocalToWorld.inverse(TransformTraits::Affine);
+        CacheTransform();
         // map textures
         for(int i = 0; i < 2; i++)
         {
             if(_texIds[i] != 0)
             {
-                Texture* tex = scene.Textures[_texIds[i]];
+                // find, not operator[], objects load concurrently
+                auto found = scene.Textures.find(_texIds[i]);
+                Texture* tex = found == scene.Textures.end() ? nullptr : found->second;
                 auto diff = dynamic_cast<DiffuseTexture*>(tex);
                 if(diff != nullptr)
                 {
@@ -97,21 +98,79 @@ namespace raytracer
         }
     }   
 
+    void Object::CacheTransform()
+    {
+        WorldToLocal = LocalToWorld.inverse(TransformTraits::Affine);
+        NormalMatrix = LocalToWorld.linear().inverse().transpose();
+        IdentityTransform = LocalToWorld.matrix().isIdentity(0);
+    }
+
+    float Object::ToLocal(const Ray& wray, Ray& ray) const
+    {
+        // motion blur is a pure translation, undo it on the origin
+        Vector3f origin = wray.Origin - MotionBlur * wray.Time;
+        if(IdentityTransform)
+        {
+            ray = Ray(origin, wray.Direction);
+            return 1;
+        }
+        Vector3f dir = WorldToLocal.linear() * wray.Direction;
+        float len = dir.norm();
+        ray = Ray(WorldToLocal * origin, dir / len);
+        return wray.Direction.norm() / len;
+    }
+
+    void Object::ToWorld(const Ray& wray, RayHit& hit) const
+    {
+        if(NormalMap != nullptr)
+        {
+            SamplerData data;
+            data.u = hit.u;
+            data.v = hit.v;
+            // spheres keep dp/du and dp/dv in TBN for the ray differentials,
+            // their normal maps take unit tangents
+            Matrix<float, 3, 3> tbn = hit.TBN;
+            if(Type == HittableType::Sphere || Type == HittableType::LightSphere)
+            {
+                tbn.col(0).normalize();
+                tbn.col(1).normalize();
+            }
+            hit.Normal = tbn * NormalMap->SampleNormal(data);
+        }
+        else if(BumpMap != nullptr)
+        {
+            SamplerData data;
+            data.u = hit.u;
+            data.v = hit.v;
+            data.point = hit.Point;
+            data.normal = hit.Normal;
+            hit.Normal = BumpMap->SampleBump(data, hit.TBN);
+        }
+        if(!IdentityTransform)
+        {
+            hit.Point = LocalToWorld * hit.Point;
+            hit.Normal = NormalMatrix * hit.Normal;
+        }
+        hit.Point += MotionBlur * wray.Time;
+        hit.Normal.normalize();
+    }
+
     Mesh::Mesh(pugi::xml_node node) : Object(node)
     {
+        Type = HittableType::Mesh;
         const char* ply = node.child("Faces").attribute("plyFile").as_string();
         _offset = node.child("Faces").attribute("vertexOffset").as_int(0);        
         _tOffset = node.child("Faces").attribute("textureOffset").as_int(0);        
+        _faceBuffer = node.child("Faces").attribute("buffer").as_int(-1);
         auto shd = node.attribute("shadingMode").as_string();
         if(std::strcmp(shd, "smooth") == 0)
             _smooth = true;
         if(std::strcmp(ply, "") == 0)
         {
-            auto faces = node.child("Faces").text().as_string();
-            std::stringstream ss;
-            ss << faces;
+            NumberReader reader(node.child("Faces").text().as_string());
+            Faces.reserve(reader.Count() / 3);
             int x, y, z;
-            while(ss >> x >> y >> z)
+            while(reader.Read(x, y, z))
             {
                 Faces.push_back(Vector3i(x, y, z));
             }
@@ -119,36 +178,26 @@ namespace raytracer
         else
         {
             _ply = true;
-            auto tris = load_trimesh_from_ply(ply);
-            auto vPos = tris->pos;
-            auto uvs = tris->uv;
-            auto fInd = tris->indices;
-            _fCount = tris->numIndices / 3;
-            _faces = new Face*[_fCount];
-            int f = 0;
-            for(int i = 0; i < _fCount; i++)
-            {
-                Vector2f* uv0 = nullptr;
-                Vector2f* uv1 = nullptr;
-                Vector2f* uv2 = nullptr;
-                if(uvs != nullptr)
-                {
-                    uv0 = new Vector2f(uvs[fInd[i * 3] * 2], uvs[fInd[i * 3] * 2 + 1]);
-                    uv1 = new Vector2f(uvs[fInd[i * 3 + 1] * 2], uvs[fInd[i * 3 + 1] * 2 + 1]);
-                    uv2 = new Vector2f(uvs[fInd[i * 3 + 2] * 2], uvs[fInd[i * 3 + 2] * 2 + 1]);
-                }
-                else
-                {
-                    uv0 = uv1 = uv2 = new Vector2f(0, 0);
-                }                
-                Faces.push_back(Vector3i(fInd[i * 3 + 0], fInd[i * 3 + 1], fInd[i * 3 + 2]));
-                auto v0 = new Vector3f(vPos[fInd[i * 3 + 0] * 3], vPos[fInd[i * 3 + 0] * 3 + 1], vPos[fInd[i * 3 + 0] * 3 + 2]);
-                auto v1 = new Vector3f(vPos[fInd[i * 3 + 1] * 3], vPos[fInd[i * 3 + 1] * 3 + 1], vPos[fInd[i * 3 + 1] * 3 + 2]);
-                auto v2 = new Vector3f(vPos[fInd[i * 3 + 2] * 3], vPos[fInd[i * 3 + 2] * 3 + 1], vPos[fInd[i * 3 + 2] * 3 + 2]);
-                _faces[f++] = new Face(v0, v1, v2, &_material, uv0, uv1, uv2);
-            }
+            PlyFile = ply;
+        }
+    }
+
+    void Mesh::ReadPly()
+    {
+        if(!LoadPly(PlyFile.c_str(), _positions, _uvs, Faces))
+        {
+            fprintf(stderr, "can't read %s\n", PlyFile.c_str());
+            exit(1);
+        }
+        bool uv = _uvs.size() == _positions.size();
+        _fCount = Faces.size();
+        _faces = new Face*[_fCount];
+        for(int i = 0; i < _fCount; i++)
+        {
+            auto& f = Faces[i];
+            _faces[i] = new Face(&_positions[f.x()], &_positions[f.y()], &_positions[f.z()],
+                uv ? &_uvs[f.x()] : &_zeroUV, uv ? &_uvs[f.y()] : &_zeroUV, uv ? &_uvs[f.z()] : &_zeroUV);
         }
-        
     }
 
     std::ostream& Mesh::Print(std::ostream& os) const
@@ -162,17 +211,19 @@ namespace raytracer
         return os;
     }
 
-    void Mesh::Load(Scene& scene)
+    void Mesh::ReadFaceBuffer(const BinaryScene& binary)
     {
-        Object::Load(scene);
-        if(_ply)
+        if(_faceBuffer >= 0 && !binary.Read(_faceBuffer, Faces))
         {
-            for(int i = 0; i < _fCount; i++)
-            {
-                _faces[i]->_material = &_material;
-            }
+            fprintf(stderr, "can't read Faces buffer %d of the binary scene\n", _faceBuffer);
+            exit(1);
         }
-        else
+    }
+
+    void Mesh::Load(Scene& scene)
+    {
+        Object::Load(scene);
+        if(!_ply)
         {        
             _fCount = Faces.size();
             _faces = new Face*[Faces.size()];
@@ -192,7 +243,7 @@ namespace raytracer
                     uv1 = new Vector2f(scene.UVData[Faces[i].y() - 1 + _tOffset]);
                     uv2 = new Vector2f(scene.UVData[Faces[i].z() - 1 + _tOffset]);
                 }
-                _faces[i] = new Face(v0, v1, v2, &_material, uv0, uv1, uv2);                
+                _faces[i] = new Face(v0, v1, v2, uv0, uv1, uv2);                
             }
         }
         if(_smooth)
@@ -240,52 +291,24 @@ namespace raytracer
         {
             return false;
         }
-        auto wtl = WorldToLocal;
-        wtl.translate(MotionBlur * -wray.Time); 
-        Ray ray(wtl * wray.Origin, (wtl.linear() * wray.Direction).normalized());
-        bool ret = bvh->Hit(ray, hit);
-        hit.Object = this;
-        hit.Material = _material;
-        hit.Texture = DiffuseMap;
-        if(NormalMap != nullptr)
-        {
-            SamplerData data;
-            data.u = hit.u;
-            data.v = hit.v;
-            hit.Normal = hit.TBN * NormalMap->SampleNormal(data);
-        }
-        else if(BumpMap != nullptr)
-        {
-            SamplerData data;
-            data.u = hit.u;
-            data.v = hit.v;
-            data.point = hit.Point;
-            data.normal = hit.Normal;
-            hit.Normal = BumpMap->SampleBump(data, hit.TBN);
-        }
-        auto ltw = LocalToWorld;
-        ltw.pretranslate(MotionBlur * wray.Time);
-        hit.Point = ltw * hit.Point;
-        hit.Normal = (ltw.linear().inverse().transpose() * hit.Normal).normalized();
-
-        if(ret){
-            hit.T = (hit.Point - wray.Origin).norm();
-        }
-        else
+        Ray ray;
+        float scale = ToLocal(wray, ray);
+        if(!bvh->Hit(ray, hit))
         {
             hit.T = FLT_MAX;
-        }        
-        return ret;
+            return false;
+        }
+        hit.T *= scale;
+        hit.Object = this;
+        hit.MaterialIndex = _materialIndex;
+        hit.Texture = DiffuseMap;
+        return true;
     }
 
     Triangle::Triangle(pugi::xml_node node) : Object(node)
     {
-        auto ind = node.child("Indices").text().as_string();
-        std::stringstream ss;
-        ss << ind;
-        int x, y, z;
-        ss >> x >> y >> z;
-        Indices = Vector3i(x, y, z);
+        Type = HittableType::Triangle;
+        Indices = Vec3iFrom(node.child("Indices"));
     }
 
     std::ostream& Triangle::Print(std::ostream& os) const
@@ -302,9 +325,10 @@ namespace raytracer
         auto v1 = new Vector3f(scene.VertexData[Indices.y() - 1]);
         auto v2 = new Vector3f(scene.VertexData[Indices.z() - 1]);
         auto u = new Vector2f(0, 0);
-        _face = Face(v0, v1, v2, &_material, u, u, u);        
+        _face = Face(v0, v1, v2, u, u, u);        
         aabb = AABB(_face.aabb);
         aabb.ApplyTransform(LocalToWorld);
+        aabb.Extend(MotionBlur);
     }   
 
     bool Triangle::Hit(const Ray& wray, RayHit& hit)
@@ -313,16 +337,20 @@ namespace raytracer
         {
             return false;
         }
-        Ray ray(WorldToLocal * wray.Origin, WorldToLocal.linear() * wray.Direction);
-        bool ret = _face.Hit(ray, hit);
-        hit.Point = LocalToWorld * hit.Point;
-        hit.Normal = (LocalToWorld.linear().inverse().transpose() * hit.Normal).normalized();
+        Ray ray;
+        float scale = ToLocal(wray, ray);
+        if(!_face.Hit(ray, hit))
+            return false;
+        hit.T *= scale;
+        hit.Object = this;
+        hit.MaterialIndex = _materialIndex;
         hit.Texture = DiffuseMap;
-        return ret;
+        return true;
     }
 
     Sphere::Sphere(pugi::xml_node node) : Object(node)
     {
+        Type = HittableType::Sphere;
         CenterId = node.child("Center").text().as_int();
         Radius = node.child("Radius").text().as_float();
     }
@@ -356,9 +384,8 @@ namespace raytracer
     
     bool Sphere::Hit(const Ray& wray, RayHit& hit)
     {
-        auto wtl = WorldToLocal;
-        wtl.translate(MotionBlur * -wray.Time); 
-        Ray ray(wtl * wray.Origin, (wtl.linear() * wray.Direction).normalized());
+        Ray ray;
+        float scale = ToLocal(wray, ray);
         hit.T = FLT_MAX;
         Vector3f oc = ray.Origin - _center;
         float a = ray.Direction.dot(ray.Direction);
@@ -379,9 +406,8 @@ namespace raytracer
             }
             if(t < 0.01)
                 return false;
-            hit.T = t;
             hit.Object = this;
-            hit.Point = ray.Origin + ray.Direction * hit.T;
+            hit.Point = ray.Origin + ray.Direction * t;
             hit.Normal = (hit.Point - _center).normalized();
             auto p = hit.Normal;
 
@@ -397,47 +423,26 @@ namespace raytracer
 
             Vector3f T = Vector3f(p.z() * 2 * M_PI, 0, p.x() * (-2) * M_PI);             
             Vector3f B = Vector3f(p.y() * std::cos(us) * M_PI, -Radius * std::sin(ut) * M_PI, p.y() * std::sin(us) * M_PI);
-            if(NormalMap != nullptr){
-                T.normalize();
-                B.normalize();
-            }
 
             hit.TBN(0, 0) = T.x(); hit.TBN(0, 1) = B.x(); hit.TBN(0, 2) = hit.Normal.x();
             hit.TBN(1, 0) = T.y(); hit.TBN(1, 1) = B.y(); hit.TBN(1, 2) = hit.Normal.y();
             hit.TBN(2, 0) = T.z(); hit.TBN(2, 1) = B.z(); hit.TBN(2, 2) = hit.Normal.z();
-            if(NormalMap != nullptr)
-            {
-                SamplerData data;
-                data.u = hit.u; data.v = hit.v;
-                hit.Normal = hit.TBN * NormalMap->SampleNormal(data);                
-            }
-            else if(BumpMap != nullptr)
-            {
-                SamplerData data;
-                data.u = hit.u; data.v = hit.v;
-                data.point = hit.Point;
-                data.normal = hit.Normal;
-                hit.Normal = BumpMap->SampleBump(data, hit.TBN).normalized();                
-            }
-            auto ltw = LocalToWorld;
-            ltw.pretranslate(MotionBlur * wray.Time);
-            hit.Point = ltw * hit.Point;
-            hit.Normal = (ltw.linear().inverse().transpose() * hit.Normal).normalized();
-            hit.Object = this;
-            hit.Material = _material;
+            hit.MaterialIndex = _materialIndex;
             hit.Texture = DiffuseMap;
-            hit.T = (hit.Point - wray.Origin).norm();
+            hit.T = t * scale;
             return true;
         }
     }
 
     Face::Face() 
-    {    }
+    {
+        Type = HittableType::Face;
+    }
     
-    Face::Face(Vector3f* v0, Vector3f* v1, Vector3f* v2, Material* material, Vector2f* uv0, Vector2f* uv1, Vector2f* uv2)
+    Face::Face(Vector3f* v0, Vector3f* v1, Vector3f* v2, Vector2f* uv0, Vector2f* uv1, Vector2f* uv2)
         : V0(v0), V1(v1), V2(v2), UV0(uv0), UV1(uv1), UV2(uv2)
     {
-        _material = material;
+        Type = HittableType::Face;
         Normal = ((*v1) - (*v0)).cross((*v2) - (*v0)).normalized();
         V0V1 = (*V1) - (*V0);
         V0V2 = (*V2) - (*V0);
@@ -507,7 +512,6 @@ namespace raytracer
         {
             hit.Normal = n;
         }
-        hit.Material = *_material;
         auto uv = (*UV0) + u * ((*UV1) - (*UV0)) + v * ((*UV2) - (*UV0));
         hit.u = uv.x();
         hit.v = uv.y();
@@ -577,6 +581,7 @@ namespace raytracer
 
     BVH::BVH(IHittable* left, IHittable* right)
     {
+        Type = HittableType::BVH;
         Left = left;
         Right = right;
         aabb.Bounds[0].x() = std::min(left->aabb.Bounds[0].x(), right->aabb.Bounds[0].x());
@@ -590,6 +595,7 @@ namespace raytracer
 
     BVH::BVH(IHittable** hs, int count)
     {
+        Type = HittableType::BVH;
         if(count == 1)
         {
             Left = Right = hs[0];
@@ -674,6 +680,22 @@ namespace raytracer
     }
 
 
+    bool IHittable::Hit(const Ray& ray, RayHit& hit)
+    {
+        switch(Type)
+        {
+            case HittableType::BVH: return static_cast<BVH*>(this)->Hit(ray, hit);
+            case HittableType::Face: return static_cast<Face*>(this)->Hit(ray, hit);
+            case HittableType::Mesh: return static_cast<Mesh*>(this)->Hit(ray, hit);
+            case HittableType::MeshInstance: return static_cast<MeshInstance*>(this)->Hit(ray, hit);
+            case HittableType::Triangle: return static_cast<Triangle*>(this)->Hit(ray, hit);
+            case HittableType::Sphere: return static_cast<Sphere*>(this)->Hit(ray, hit);
+            case HittableType::LightSphere: return static_cast<LightSphere*>(this)->Hit(ray, hit);
+            case HittableType::LightMesh: return static_cast<LightMesh*>(this)->Hit(ray, hit);
+            default: return false;
+        }
+    }
+
     bool BVH::Hit(const Ray& ray, RayHit& hit)
     {
         if(!aabb.Intersect(ray))
@@ -703,7 +725,8 @@ namespace raytracer
     }
 
     MeshInstance::MeshInstance(pugi::xml_node node) : Object(node)
-    {   
+    {
+        Type = HittableType::MeshInstance;
         BaseMeshId = node.attribute("baseMeshId").as_int();
         ResetTransform = node.attribute("resetTransform").as_bool();
     }
@@ -720,7 +743,7 @@ namespace raytracer
                 {
                     auto& bt = scene.Objects[i]->LocalToWorld;
                     LocalToWorld = LocalToWorld * bt;
-                    WorldToLocal = LocalToWorld.inverse();
+                    CacheTransform();
                 }
                 break;
             }
@@ -740,24 +763,17 @@ namespace raytracer
         {
             return false;
         }
-        auto wtl = WorldToLocal;
-        wtl.translate(MotionBlur * -wray.Time); 
-        Ray ray(wtl * wray.Origin, (wtl.linear() * wray.Direction).normalized());
-        bool ret = bvh->Hit(ray, hit);
-        auto ltw = LocalToWorld;
-        ltw.pretranslate(MotionBlur * wray.Time);
-        hit.Point = ltw * hit.Point;
-        hit.Normal = (ltw.linear().inverse().transpose() * hit.Normal).normalized();
-        hit.Object = this;
-        hit.Material = _material;
-        hit.Texture = DiffuseMap;
-        if(ret){
-            hit.T = (hit.Point - wray.Origin).norm();
-        }
-        else
+        Ray ray;
+        float scale = ToLocal(wray, ray);
+        if(!bvh->Hit(ray, hit))
         {
             hit.T = FLT_MAX;
-        }        
-        return ret;
+            return false;
+        }
+        hit.T *= scale;
+        hit.Object = this;
+        hit.MaterialIndex = _materialIndex;
+        hit.Texture = DiffuseMap;
+        return true;
     }
 }
\ No newline at end of file
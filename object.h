@@ -14,18 +14,24 @@ namespace raytracer
 {
     class Object;
     class Scene;
+    class BinaryScene;
 
     class RayHit
     {
         public:
             Object* Object;
-            Material Material;
+            // index into Scene::Materials
+            int MaterialIndex = 0;
             float T;
             Vector3f Point;
             Vector3f Normal;
             DiffuseTexture* Texture;
             float u, v;
             Matrix<float, 3, 3> TBN;
+            // surface point and uv change towards the ray's neighbouring samples
+            bool HasDifferentials = false;
+            Vector3f dpdx, dpdy;
+            float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
     };
     
     class AABB
@@ -49,36 +55,43 @@ namespace raytracer
                 Bounds[0].x() = std::min(Bounds[0].x(), b0.x());
                 Bounds[0].y() = std::min(Bounds[0].y(), b0.y());
                 Bounds[0].z() = std::min(Bounds[0].z(), b0.z());
-                Bounds[1].x() = std::min(Bounds[1].x(), b1.x());
-                Bounds[1].y() = std::min(Bounds[1].y(), b1.y());
-                Bounds[1].z() = std::min(Bounds[1].z(), b1.z());
+                Bounds[1].x() = std::max(Bounds[1].x(), b1.x());
+                Bounds[1].y() = std::max(Bounds[1].y(), b1.y());
+                Bounds[1].z() = std::max(Bounds[1].z(), b1.z());
+                Center = (Bounds[0] + Bounds[1]) / 2;
             }
     };
 
+    enum class HittableType : unsigned char
+    {
+        None, BVH, Face, Mesh, MeshInstance, Triangle, Sphere, LightSphere, LightMesh
+    };
+
     class IHittable
     {
         public:
-            virtual bool Hit(const Ray& ray, RayHit& hit) {return false;}
+            // switches on Type and calls the concrete Hit, no virtual call
+            bool Hit(const Ray& ray, RayHit& hit);
             AABB aabb;
+            HittableType Type = HittableType::None;
     };
 
     class BVH : public IHittable
     {
         public:
-            BVH(){}
+            BVH() { Type = HittableType::BVH; }
             BVH(IHittable** hs, int count);
             BVH(IHittable* right, IHittable* left);
             IHittable* Left;
             IHittable* Right;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            bool Hit(const Ray& ray, RayHit& hit);
     };
 
     class Face : public IHittable
     {
         public:
             Face();
-            Face(Vector3f* v0, Vector3f* v1, Vector3f* v2, Material* material,
-                    Vector2f* uv0, Vector2f* uv1, Vector2f* uv2);
+            Face(Vector3f* v0, Vector3f* v1, Vector3f* v2, Vector2f* uv0, Vector2f* uv1, Vector2f* uv2);
             Vector3f* V0;
             Vector3f* V1;
             Vector3f* V2;
@@ -91,11 +104,10 @@ namespace raytracer
             Vector3f V0N;
             Vector3f V1N;
             Vector3f V2N;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            bool Hit(const Ray& ray, RayHit& hit);
             float GetArea(Transform<float, 3, Affine> ltw);
             Vector3f SamplePoint(float r1, float r2);
 //        private:
-            Material* _material;
             Matrix<float, 3, 3> TBN;
             bool smooth = false;
     };
@@ -109,15 +121,22 @@ namespace raytracer
             friend std::ostream& operator<<(std::ostream& os, const Object& mesh);
             virtual std::ostream& Print(std::ostream& os) const;
             virtual void Load(Scene& scene);
+            // object space ray, returns the factor from object space distance to world distance
+            float ToLocal(const Ray& wray, Ray& ray) const;
+            // maps the final object space hit to world space, applies normal and bump maps
+            void ToWorld(const Ray& wray, RayHit& hit) const;
+            void CacheTransform();
             std::string Transformations;
             Transform<float, 3, Affine> LocalToWorld;
             Transform<float, 3, Affine> WorldToLocal;
+            Matrix3f NormalMatrix;
+            bool IdentityTransform;
             Vector3f MotionBlur;
             DiffuseTexture* DiffuseMap = NULL;
             NormalTexture* NormalMap = NULL;
             BumpTexture* BumpMap = NULL; 
         protected:
-            Material _material;
+            int _materialIndex = 0;
             int _texIds[2];
     };
 
@@ -126,8 +145,14 @@ namespace raytracer
         public:
             Mesh(pugi::xml_node node);
             std::vector<Vector3i> Faces;
+            // empty unless the faces come from a ply file
+            std::string PlyFile;
+            // reads PlyFile and builds the faces, safe to run for several meshes at once
+            void ReadPly();
+            // copies inline faces from the binary scene's buffer, exits if it can't be read
+            void ReadFaceBuffer(const BinaryScene& binary);
             virtual std::ostream& Print(std::ostream& os) const override;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            bool Hit(const Ray& ray, RayHit& hit);
             virtual void Load(Scene& scene) override;
             BVH* bvh;
         protected:
@@ -137,6 +162,12 @@ namespace raytracer
             int _offset;
             int _tOffset;
             bool _smooth = false;
+            // faces stored in a binary scene buffer, -1 when inline or ply
+            int _faceBuffer;
+            // vertex buffers of a ply mesh, faces point into them
+            std::vector<Vector3f> _positions;
+            std::vector<Vector2f> _uvs;
+            Vector2f _zeroUV = Vector2f::Zero();
     };
 
     class MeshInstance : public Object
@@ -145,7 +176,7 @@ namespace raytracer
             MeshInstance(pugi::xml_node node);
             int BaseMeshId;
             bool ResetTransform;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            bool Hit(const Ray& ray, RayHit& hit);
             virtual void Load(Scene& scene) override;
             BVH* bvh;            
     };
@@ -156,7 +187,7 @@ namespace raytracer
             Triangle(pugi::xml_node node);
             Vector3i Indices;
             virtual std::ostream& Print(std::ostream& os) const override;            
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            bool Hit(const Ray& ray, RayHit& hit);
             virtual void Load(Scene& scene) override;
         private:
             Face _face;            
@@ -169,7 +200,7 @@ namespace raytracer
             int CenterId;
             float Radius;
             virtual std::ostream& Print(std::ostream& os) const override;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            bool Hit(const Ray& ray, RayHit& hit);
             virtual void Load(Scene& scene) override;
         protected:
             Vector3f _center;            
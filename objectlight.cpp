@@ -4,26 +4,30 @@ namespace raytracer
 {
     LightSphere::LightSphere(pugi::xml_node node) : Light(node), Sphere(node)
     {
+        Light::Type = LightType::Sphere;
+        IHittable::Type = HittableType::LightSphere;
+        Shape = this;
         Radiance = Vec3fFrom(node.child("Radiance"));
     }
 
     LightMesh::LightMesh(pugi::xml_node node) : Light(node), Mesh(node)
     {
+        Light::Type = LightType::Mesh;
+        IHittable::Type = HittableType::LightMesh;
+        Shape = this;
         Radiance = Vec3fFrom(node.child("Radiance"));
     }
 
     void LightMesh::Load(Scene& scene)
     {
         Mesh::Load(scene);
-        totalArea = 0;
-        std::vector<float> probs;
+        std::vector<float> areas(_fCount);
         for(int i = 0; i < _fCount; i++)
         {
-            float a = _faces[i]->GetArea(LocalToWorld);
-            probs.push_back(a);
-            totalArea += a;
+            areas[i] = _faces[i]->GetArea(LocalToWorld);
         }
-        rnd = std::discrete_distribution<int>(probs.begin(), probs.end());
+        _faceTable = AliasTable(areas);
+        totalArea = _faceTable.Total;
     }
 
 
@@ -36,8 +40,8 @@ namespace raytracer
         rd *= rd;
         rd = rd > 1 ? 1 : rd;
         float costhetamax = std::sqrt(1 - rd);
-        float r1 = rnd(generator);
-        float r2 = rnd(generator);
+        float r1 = rnd(Random::Thread());
+        float r2 = rnd(Random::Thread());
         float thetai = std::acos(1 - r1 + r1 * costhetamax);
         float phii = 2 * M_PI * r2;
         auto w = (_center - plocal).normalized();
@@ -60,15 +64,18 @@ namespace raytracer
         llocal.normalize();
         dir = (LocalToWorld.linear() * llocal).normalized();
         Vector3f sp = _center - llocal * Radius;
-        sp = LocalToWorld * sp;        
-        return (sp - point).norm();
+        lnormal = (WorldToLocal.linear().transpose() * -llocal).normalized();
+        sample = LocalToWorld * sp;        
+        return (sample - point).norm();
     }
 
     float LightMesh::SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal)
     {
-        int tri = rnd(generator);
-        float r1 = urnd(generator);
-        float r2 = urnd(generator);
+        auto& rng = Random::Thread();
+        float pdf;
+        int tri = _faceTable.Sample(rng.Uniform(), pdf);
+        float r1 = rng.Uniform();
+        float r2 = rng.Uniform();
         Vector3f lp = _faces[tri]->SamplePoint(r1, r2);
         lnormal = (LocalToWorld.linear() * _faces[tri]->Normal).normalized();
         sample = LocalToWorld * lp;
@@ -98,6 +105,48 @@ namespace raytracer
         return Radiance * totalArea * theta / r;
     }
 
+    float LightSphere::Power(float sceneRadius)
+    {
+        float r = Radius * LocalToWorld.linear().norm() / std::sqrt(3.0f);
+        return 4 * M_PI * M_PI * r * r * Luminance(Radiance);
+    }
+
+    float LightMesh::Power(float sceneRadius)
+    {
+        return M_PI * totalArea * Luminance(Radiance);
+    }
+
+    float LightSphere::SamplePdf(Vector3f point, Vector3f lsample, Vector3f lnormal)
+    {
+        // uniform over the cone, same as GetLuminance
+        auto plocal = WorldToLocal * point;
+        float rd = Radius / (_center - plocal).norm();
+        rd *= rd;
+        rd = rd > 1 ? 1 : rd;
+        float costhetamax = std::sqrt(1 - rd);
+        return 1 / (2 * M_PI * (1 - costhetamax));
+    }
+
+    float LightMesh::SamplePdf(Vector3f point, Vector3f lsample, Vector3f lnormal)
+    {
+        // area pdf 1 / totalArea converted to solid angle
+        Vector3f d = lsample - point;
+        float costheta = std::fabs(d.normalized().dot(lnormal));
+        if(costheta <= 0)
+            return 0;
+        return d.squaredNorm() / (costheta * totalArea);
+    }
+
+    Vector3f LightSphere::Emitted()
+    {
+        return Radiance;
+    }
+
+    Vector3f LightMesh::Emitted()
+    {
+        return Radiance;
+    }
+
     bool LightSphere::Hit(const Ray& ray, RayHit& hit)
     {
         if(ray.Ignore == Id)
@@ -1,6 +1,7 @@
 #pragma once
 #include "object.h"
 #include "light.h"
+#include "distribution.h"
 
 namespace raytracer
 {
@@ -8,12 +9,14 @@ namespace raytracer
     {
         public:
             LightSphere(pugi::xml_node node);
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
+            float SamplePdf(Vector3f point, Vector3f lsample, Vector3f lnormal);
+            Vector3f Emitted();
+            bool Hit(const Ray& ray, RayHit& hit);
             Vector3f Radiance;
         private:
-            std::default_random_engine generator;
             std::uniform_real_distribution<float> rnd;
 
     };
@@ -23,15 +26,16 @@ namespace raytracer
         public:
             LightMesh(pugi::xml_node node);
             virtual void Load(Scene& scene) override;
-            virtual float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal) override;
-            virtual Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample) override;
-            virtual bool Hit(const Ray& ray, RayHit& hit) override;
+            float SamplePoint(Vector3f point, Vector3f normal, Vector3f& sample, Vector3f& dir, Vector3f& lnormal);
+            Vector3f GetLuminance(Vector3f point, Vector3f normal, Vector3f lsample);
+            float Power(float sceneRadius);
+            float SamplePdf(Vector3f point, Vector3f lsample, Vector3f lnormal);
+            Vector3f Emitted();
+            bool Hit(const Ray& ray, RayHit& hit);
             Vector3f Radiance;
         private:
             float totalArea;
-            std::default_random_engine generator;
-            std::discrete_distribution<int> rnd;
-            std::uniform_real_distribution<float> urnd;
+            AliasTable _faceTable;
     };
 }
 
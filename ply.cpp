@@ -0,0 +1,507 @@
+#include "ply.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include "vecfrom.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace raytracer
+{
+    enum class PlyFormat
+    {
+        Ascii,
+        BinaryLittleEndian,
+        BinaryBigEndian
+    };
+
+    enum class PlyType
+    {
+        Int8,
+        UInt8,
+        Int16,
+        UInt16,
+        Int32,
+        UInt32,
+        Float32,
+        Float64,
+        Invalid
+    };
+
+    struct PlyProperty
+    {
+        std::string Name;
+        PlyType Type;
+        // a list stores a CountType length followed by that many values of Type
+        bool List = false;
+        PlyType CountType = PlyType::Invalid;
+    };
+
+    struct PlyElement
+    {
+        std::string Name;
+        size_t Count = 0;
+        std::vector<PlyProperty> Properties;
+        // bytes per binary row, 0 when rows hold lists
+        size_t RowSize = 0;
+
+        int Find(const char* name) const
+        {
+            for(size_t i = 0; i < Properties.size(); i++)
+                if(Properties[i].Name == name)
+                    return i;
+            return -1;
+        }
+    };
+
+    // which element and properties hold the mesh
+    struct PlyLayout
+    {
+        int Vertex = -1;
+        int Face = -1;
+        int X, Y, Z;
+        int U = -1;
+        int V = -1;
+        int Indices = -1;
+    };
+
+    static PlyType ParseType(const std::string& name)
+    {
+        if(name == "char" || name == "int8") return PlyType::Int8;
+        if(name == "uchar" || name == "uint8") return PlyType::UInt8;
+        if(name == "short" || name == "int16") return PlyType::Int16;
+        if(name == "ushort" || name == "uint16") return PlyType::UInt16;
+        if(name == "int" || name == "int32") return PlyType::Int32;
+        if(name == "uint" || name == "uint32") return PlyType::UInt32;
+        if(name == "float" || name == "float32") return PlyType::Float32;
+        if(name == "double" || name == "float64") return PlyType::Float64;
+        return PlyType::Invalid;
+    }
+
+    static size_t TypeSize(PlyType type)
+    {
+        switch(type)
+        {
+            case PlyType::Int8:
+            case PlyType::UInt8:
+                return 1;
+            case PlyType::Int16:
+            case PlyType::UInt16:
+                return 2;
+            case PlyType::Int32:
+            case PlyType::UInt32:
+            case PlyType::Float32:
+                return 4;
+            case PlyType::Float64:
+                return 8;
+            default:
+                return 0;
+        }
+    }
+
+    template<typename V>
+    static V Load(const unsigned char* p, bool swap)
+    {
+        unsigned char b[sizeof(V)];
+        for(size_t i = 0; i < sizeof(V); i++)
+            b[i] = p[swap ? sizeof(V) - 1 - i : i];
+        V v;
+        std::memcpy(&v, b, sizeof(V));
+        return v;
+    }
+
+    // decodes one binary value, swapping bytes for big endian files
+    template<typename T>
+    static T Value(const unsigned char* p, PlyType type, bool swap)
+    {
+        switch(type)
+        {
+            case PlyType::Int8: return (T)Load<int8_t>(p, swap);
+            case PlyType::UInt8: return (T)Load<uint8_t>(p, swap);
+            case PlyType::Int16: return (T)Load<int16_t>(p, swap);
+            case PlyType::UInt16: return (T)Load<uint16_t>(p, swap);
+            case PlyType::Int32: return (T)Load<int32_t>(p, swap);
+            case PlyType::UInt32: return (T)Load<uint32_t>(p, swap);
+            case PlyType::Float32: return (T)Load<float>(p, swap);
+            case PlyType::Float64: return (T)Load<double>(p, swap);
+            default: return 0;
+        }
+    }
+
+    static std::vector<std::string> Words(const char* begin, const char* end)
+    {
+        std::vector<std::string> words;
+        const char* p = begin;
+        while(p < end)
+        {
+            while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+            const char* w = p;
+            while(p < end && *p != ' ' && *p != '\t' && *p != '\r')
+                p++;
+            if(p > w)
+                words.emplace_back(w, p);
+        }
+        return words;
+    }
+
+    // returns the start of the body, or nullptr if the header is malformed
+    static const char* ParseHeader(const char* text, const char* end, PlyFormat& format, std::vector<PlyElement>& elements)
+    {
+        const char* p = text;
+        bool first = true;
+        bool hasFormat = false;
+        while(p < end)
+        {
+            auto eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if(eol == nullptr)
+                return nullptr;
+            auto words = Words(p, eol);
+            p = eol + 1;
+            if(first)
+            {
+                if(words.size() != 1 || words[0] != "ply")
+                    return nullptr;
+                first = false;
+            }
+            else if(words.empty() || words[0] == "comment" || words[0] == "obj_info")
+            {
+                continue;
+            }
+            else if(words[0] == "format" && words.size() >= 2)
+            {
+                if(words[1] == "ascii")
+                    format = PlyFormat::Ascii;
+                else if(words[1] == "binary_little_endian")
+                    format = PlyFormat::BinaryLittleEndian;
+                else if(words[1] == "binary_big_endian")
+                    format = PlyFormat::BinaryBigEndian;
+                else
+                    return nullptr;
+                hasFormat = true;
+            }
+            else if(words[0] == "element" && words.size() >= 3)
+            {
+                PlyElement element;
+                element.Name = words[1];
+                element.Count = std::strtoull(words[2].c_str(), nullptr, 10);
+                elements.push_back(element);
+            }
+            else if(words[0] == "property" && !elements.empty())
+            {
+                PlyProperty prop;
+                if(words.size() >= 5 && words[1] == "list")
+                {
+                    prop.List = true;
+                    prop.CountType = ParseType(words[2]);
+                    prop.Type = ParseType(words[3]);
+                    prop.Name = words[4];
+                    if(prop.CountType == PlyType::Invalid)
+                        return nullptr;
+                }
+                else if(words.size() >= 3)
+                {
+                    prop.Type = ParseType(words[1]);
+                    prop.Name = words[2];
+                }
+                else
+                {
+                    return nullptr;
+                }
+                if(prop.Type == PlyType::Invalid)
+                    return nullptr;
+                elements.back().Properties.push_back(prop);
+            }
+            else if(words[0] == "end_header")
+            {
+                for(auto& element: elements)
+                {
+                    element.RowSize = 0;
+                    for(auto& prop: element.Properties)
+                    {
+                        if(prop.List)
+                        {
+                            element.RowSize = 0;
+                            break;
+                        }
+                        element.RowSize += TypeSize(prop.Type);
+                    }
+                }
+                return hasFormat ? p : nullptr;
+            }
+            else
+            {
+                return nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // quads are split along the 1-3 diagonal, larger polygons as a fan
+    static void Triangulate(const int* poly, int n, std::vector<Vector3i>& triangles)
+    {
+        if(n == 4)
+        {
+            triangles.emplace_back(poly[0], poly[1], poly[3]);
+            triangles.emplace_back(poly[2], poly[3], poly[1]);
+            return;
+        }
+        for(int i = 1; i + 1 < n; i++)
+            triangles.emplace_back(poly[0], poly[i], poly[i + 1]);
+    }
+
+    static bool ReadBinary(const unsigned char* p, const unsigned char* end, bool swap,
+            const std::vector<PlyElement>& elements, const PlyLayout& layout,
+            std::vector<Vector3f>& positions, std::vector<Vector2f>& uvs, std::vector<Vector3i>& triangles)
+    {
+        for(int e = 0; e < (int)elements.size(); e++)
+        {
+            auto& element = elements[e];
+            auto& props = element.Properties;
+            if(element.RowSize > 0)
+            {
+                if((size_t)(end - p) / element.RowSize < element.Count)
+                    return false;
+                if(e == layout.Vertex)
+                {
+                    std::vector<size_t> offsets(props.size(), 0);
+                    for(size_t k = 1; k < props.size(); k++)
+                        offsets[k] = offsets[k - 1] + TypeSize(props[k - 1].Type);
+                    // fixed size rows decode independently
+                    ThreadPool::Shared().For(element.Count, 65536, [&](size_t begin, size_t last)
+                    {
+                        for(size_t i = begin; i < last; i++)
+                        {
+                            auto row = p + i * element.RowSize;
+                            positions[i] = Vector3f(Value<float>(row + offsets[layout.X], props[layout.X].Type, swap),
+                                Value<float>(row + offsets[layout.Y], props[layout.Y].Type, swap),
+                                Value<float>(row + offsets[layout.Z], props[layout.Z].Type, swap));
+                            if(layout.U >= 0)
+                                uvs[i] = Vector2f(Value<float>(row + offsets[layout.U], props[layout.U].Type, swap),
+                                    Value<float>(row + offsets[layout.V], props[layout.V].Type, swap));
+                        }
+                    });
+                }
+                p += element.RowSize * element.Count;
+                continue;
+            }
+            // rows with lists have to be walked in order
+            std::vector<float> values(props.size(), 0);
+            std::vector<int> poly;
+            for(size_t i = 0; i < element.Count; i++)
+            {
+                for(int k = 0; k < (int)props.size(); k++)
+                {
+                    auto& prop = props[k];
+                    size_t size = TypeSize(prop.Type);
+                    if(!prop.List)
+                    {
+                        if((size_t)(end - p) < size)
+                            return false;
+                        values[k] = Value<float>(p, prop.Type, swap);
+                        p += size;
+                        continue;
+                    }
+                    size_t countSize = TypeSize(prop.CountType);
+                    if((size_t)(end - p) < countSize)
+                        return false;
+                    int64_t n = Value<int64_t>(p, prop.CountType, swap);
+                    p += countSize;
+                    if(n < 0 || (size_t)(end - p) / size < (size_t)n)
+                        return false;
+                    if(e == layout.Face && k == layout.Indices)
+                    {
+                        poly.resize(n);
+                        for(int j = 0; j < n; j++)
+                            poly[j] = Value<int>(p + j * size, prop.Type, swap);
+                        Triangulate(poly.data(), n, triangles);
+                    }
+                    p += n * size;
+                }
+                if(e == layout.Vertex)
+                {
+                    positions[i] = Vector3f(values[layout.X], values[layout.Y], values[layout.Z]);
+                    if(layout.U >= 0)
+                        uvs[i] = Vector2f(values[layout.U], values[layout.V]);
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool ReadAscii(const char* data, const char* end, const std::vector<PlyElement>& elements,
+            const PlyLayout& layout, std::vector<Vector3f>& positions, std::vector<Vector2f>& uvs,
+            std::vector<Vector3i>& triangles)
+    {
+        auto& pool = ThreadPool::Shared();
+        size_t size = end - data;
+        int chunks = std::max<size_t>(1, std::min<size_t>(pool.Size() * 4, size >> 20));
+        // chunk bounds moved forward to line starts
+        std::vector<const char*> bounds(chunks + 1);
+        bounds[0] = data;
+        bounds[chunks] = end;
+        for(int k = 1; k < chunks; k++)
+        {
+            const char* p = std::max(bounds[k - 1], data + size * k / chunks);
+            auto eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            bounds[k] = eol != nullptr ? eol + 1 : end;
+        }
+        // lines per chunk, so each chunk knows the row of its first line
+        std::vector<size_t> first(chunks + 1, 0);
+        pool.For(chunks, 1, [&](size_t k, size_t)
+        {
+            size_t lines = std::count(bounds[k], bounds[k + 1], '\n');
+            if(bounds[k + 1] > bounds[k] && bounds[k + 1][-1] != '\n')
+                lines++;
+            first[k + 1] = lines;
+        });
+        for(int k = 0; k < chunks; k++)
+            first[k + 1] += first[k];
+        std::vector<size_t> start(elements.size() + 1, 0);
+        for(size_t e = 0; e < elements.size(); e++)
+            start[e + 1] = start[e] + elements[e].Count;
+        if(first[chunks] < start[elements.size()])
+            return false;
+
+        std::vector<std::vector<Vector3i>> faces(chunks);
+        std::atomic<bool> ok(true);
+        pool.For(chunks, 1, [&](size_t k, size_t)
+        {
+            std::vector<float> values;
+            std::vector<int> poly;
+            size_t line = first[k];
+            int e = std::upper_bound(start.begin(), start.end(), line) - start.begin() - 1;
+            for(const char* p = bounds[k]; p < bounds[k + 1] && e < (int)elements.size(); line++)
+            {
+                auto eol = static_cast<const char*>(std::memchr(p, '\n', bounds[k + 1] - p));
+                if(eol == nullptr)
+                    eol = bounds[k + 1];
+                while(e < (int)elements.size() && line >= start[e + 1])
+                    e++;
+                if(e == layout.Vertex || e == layout.Face)
+                {
+                    auto& props = elements[e].Properties;
+                    values.assign(props.size(), 0);
+                    NumberReader reader(p, eol);
+                    bool good = true;
+                    for(int i = 0; good && i < (int)props.size(); i++)
+                    {
+                        if(!props[i].List)
+                        {
+                            good = reader.Read(values[i]);
+                            continue;
+                        }
+                        int n;
+                        good = reader.Read(n) && n >= 0;
+                        if(e == layout.Face && i == layout.Indices)
+                        {
+                            poly.resize(good ? n : 0);
+                            for(int j = 0; good && j < n; j++)
+                                good = reader.Read(poly[j]);
+                            if(good)
+                                Triangulate(poly.data(), n, faces[k]);
+                        }
+                        else
+                        {
+                            // other lists, like per face texcoords, are skipped
+                            float skip;
+                            for(int j = 0; good && j < n; j++)
+                                good = reader.Read(skip);
+                        }
+                    }
+                    if(!good)
+                    {
+                        ok = false;
+                        return;
+                    }
+                    if(e == layout.Vertex)
+                    {
+                        size_t row = line - start[e];
+                        positions[row] = Vector3f(values[layout.X], values[layout.Y], values[layout.Z]);
+                        if(layout.U >= 0)
+                            uvs[row] = Vector2f(values[layout.U], values[layout.V]);
+                    }
+                }
+                p = eol + 1;
+            }
+        });
+        size_t total = 0;
+        for(auto& f: faces)
+            total += f.size();
+        triangles.reserve(total);
+        for(auto& f: faces)
+            triangles.insert(triangles.end(), f.begin(), f.end());
+        return ok;
+    }
+
+    bool LoadPly(const char* filename, std::vector<Vector3f>& positions,
+            std::vector<Vector2f>& uvs, std::vector<Vector3i>& triangles)
+    {
+        MappedFile file(filename);
+        if(file.Data() == nullptr)
+            return false;
+        auto text = reinterpret_cast<const char*>(file.Data());
+        auto end = text + file.Size();
+        PlyFormat format = PlyFormat::Ascii;
+        std::vector<PlyElement> elements;
+        auto body = ParseHeader(text, end, format, elements);
+        if(body == nullptr)
+            return false;
+
+        PlyLayout layout;
+        for(int e = 0; e < (int)elements.size(); e++)
+        {
+            if(elements[e].Name == "vertex")
+                layout.Vertex = e;
+            else if(elements[e].Name == "face")
+                layout.Face = e;
+        }
+        if(layout.Vertex < 0 || layout.Face < 0)
+            return false;
+        auto& vertex = elements[layout.Vertex];
+        layout.X = vertex.Find("x");
+        layout.Y = vertex.Find("y");
+        layout.Z = vertex.Find("z");
+        if(layout.X < 0 || layout.Y < 0 || layout.Z < 0)
+            return false;
+        const char* uvNames[4][2] = {{"u", "v"}, {"s", "t"}, {"texture_u", "texture_v"}, {"texture_s", "texture_t"}};
+        for(auto& names: uvNames)
+        {
+            if(vertex.Find(names[0]) >= 0 && vertex.Find(names[1]) >= 0)
+            {
+                layout.U = vertex.Find(names[0]);
+                layout.V = vertex.Find(names[1]);
+                break;
+            }
+        }
+        for(int k: {layout.X, layout.Y, layout.Z, layout.U, layout.V})
+            if(k >= 0 && vertex.Properties[k].List)
+                return false;
+        auto& face = elements[layout.Face];
+        layout.Indices = face.Find("vertex_indices");
+        if(layout.Indices < 0)
+            layout.Indices = face.Find("vertex_index");
+        if(layout.Indices < 0 || !face.Properties[layout.Indices].List)
+            return false;
+
+        positions.resize(vertex.Count);
+        uvs.resize(layout.U >= 0 ? vertex.Count : 0);
+        triangles.clear();
+        triangles.reserve(face.Count);
+        bool ok;
+        if(format == PlyFormat::Ascii)
+            ok = ReadAscii(body, end, elements, layout, positions, uvs, triangles);
+        else
+            ok = ReadBinary(reinterpret_cast<const unsigned char*>(body), file.Data() + file.Size(),
+                format == PlyFormat::BinaryBigEndian, elements, layout, positions, uvs, triangles);
+        if(!ok)
+            return false;
+        for(auto& t: triangles)
+            if(t.minCoeff() < 0 || t.maxCoeff() >= (int)positions.size())
+                return false;
+        return true;
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "Eigen/Dense"
+#include <vector>
+
+using namespace Eigen;
+
+namespace raytracer
+{
+    // Reads the vertex positions, optional texture coordinates and faces of a
+    // PLY file straight into the given buffers. The file is memory-mapped;
+    // binary rows are decoded in place and ASCII rows are parsed in parallel
+    // chunks. Polygons are split into triangles, indices are 0 based.
+    bool LoadPly(const char* filename, std::vector<Vector3f>& positions,
+            std::vector<Vector2f>& uvs, std::vector<Vector3i>& triangles);
+}
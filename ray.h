@@ -18,7 +18,11 @@ namespace raytracer
             int Sign[3];
             float N = 1;
             float Dist;
-            float Time;
-            int Ignore;
+            float Time = 0;
+            int Ignore = -1;
+            // rays through the neighbouring samples in x and y, they size texture lookups
+            bool HasDifferentials = false;
+            Vector3f RxOrigin, RxDirection;
+            Vector3f RyOrigin, RyDirection;
     };
 }
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+
+namespace raytracer
+{
+    // PCG32 generator, one instance per render thread.
+    // The renderer reseeds it from (pixel, sample) before every camera sample so
+    // the image does not depend on thread scheduling and a render can be resumed.
+    class Random
+    {
+        public:
+            typedef uint32_t result_type;
+            static constexpr result_type min() { return 0; }
+            static constexpr result_type max() { return UINT32_MAX; }
+
+            static Random& Thread()
+            {
+                thread_local Random instance;
+                return instance;
+            }
+
+            void Seed(uint64_t index, uint64_t sample)
+            {
+                _state = 0;
+                _inc = (index << 1u) | 1u;
+                (*this)();
+                _state += 0x853c49e6748fea9bULL ^ (sample * 0x9e3779b97f4a7c15ULL);
+                (*this)();
+            }
+
+            result_type operator()()
+            {
+                uint64_t old = _state;
+                _state = old * 6364136223846793005ULL + _inc;
+                uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+                uint32_t rot = (uint32_t)(old >> 59u);
+                return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+            }
+
+            // uniform float in [0, 1)
+            float Uniform()
+            {
+                return ((*this)() >> 8) * (1.0f / 16777216.0f);
+            }
+
+        private:
+            uint64_t _state = 0x853c49e6748fea9bULL;
+            uint64_t _inc = 0xda3e39cb94b95bdbULL;
+    };
+}
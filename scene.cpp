@@ -1,18 +1,29 @@
 #include "scene.h"
 #include <stdlib.h>
 #include <string>
-#include <sstream>
 #include <cfloat>
-#include "lodepng.h"
 #include <cmath>
 #include <thread>
 #include <chrono>
 #include <future>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <unistd.h>
 #include "tonemapper.h"
+#include "accumulator.h"
+#include "rng.h"
+#include "threadpool.h"
 
 namespace raytracer
 {
-    Scene::Scene(pugi::xml_node node)
+    Scene::Scene(pugi::xml_node node, const BinaryScene* binary) : Binary(binary)
     {
         BackgroundColor =  Vec3fFrom(node.child("BackgroundColor"));
         ShadowRayEpsilon = node.child("ShadowRayEpsilon").text().as_float();
@@ -23,16 +34,43 @@ namespace raytracer
             MaxRecursionDepth = 1;
 
         IntersectionTestEpsilon = node.child("IntersectionTestEpsilon").text().as_float();
+        // 0 shades every light at every point
+        LightSamples = node.child("LightSamples").text().as_int(0);
         auto cameras = node.child("Cameras");
         for(auto& camera: cameras.children())
         {
             Cameras.push_back(Camera(camera));
+            Cameras.back().Index = Cameras.size() - 1;
+        }
+        if(std::any_of(Cameras.begin(), Cameras.end(), [](const Camera& cam) { return cam.Progressive; }))
+        {
+            // time limit and write intervals may change between runs
+            pugi::xml_document copy;
+            auto scene = copy.append_copy(node);
+            for(auto camera: scene.child("Cameras").children())
+            {
+                auto progressive = camera.child("Progressive");
+                for(auto name: {"TimeLimit", "SnapshotInterval", "CheckpointInterval"})
+                    progressive.remove_child(name);
+            }
+            std::ostringstream text;
+            scene.print(text, "", pugi::format_raw);
+            Hash = Fnv1a(text.str().data(), text.str().size());
+            if(binary != nullptr)
+                Hash = Fnv1a(binary->Data(), binary->Size(), Hash);
         }
+        // megabytes of image tiles kept in memory, 0 keeps every image whole
+        TextureCache::Shared().SetBudget(node.child("TextureCacheSize").text().as_float(0) * 1024 * 1024);
+        // baked procedurals keep their bricks there across runs
+        BakedSampler::SetDirectory(node.child("BakeDirectory").text().as_string());
         auto images = node.child("Textures").child("Images");
         for(auto& image: images.children())
         {
             ResourceLocator::GetInstance().AddImage(new Image(image));
         }
+        // images something refers to are decoded while the rest of the scene is
+        // parsed, the ones nothing refers to are never read
+        auto decodes = DecodeImages(node);
                 auto brdfs = node.child("BRDFs");
         for(auto& brdf: brdfs.children())
         {
@@ -96,19 +134,45 @@ namespace raytracer
         {
             Materials.push_back(Material(material));
         }
-        auto vertices = node.child("VertexData");
-        std::stringstream vs;
-        vs << vertices.first_child().text().as_string();
+        // black default for objects whose material is missing
+        Materials.push_back(Material());
+        // reflectances are degammaed once for each camera's gamma; fast shading
+        // looks fresnel and lobe powers up in tables, meant for previews
+        std::vector<float> gammas;
+        for(auto& cam: Cameras)
+            gammas.push_back(cam.Gamma);
+        bool fast = std::strcmp(node.child("ShadingAccuracy").text().as_string(), "Fast") == 0;
+        for(auto& material: Materials)
+            material.Compile(gammas, fast);
+        if(Binary != nullptr && node.child("VertexData").attribute("buffer"))
+        {
+            int buffer = node.child("VertexData").attribute("buffer").as_int();
+            if(!Binary->Read(buffer, VertexData))
+            {
+                fprintf(stderr, "can't read VertexData buffer %d of the binary scene\n", buffer);
+                exit(1);
+            }
+        }
+        NumberReader vs(node.child("VertexData").text().as_string());
+        VertexData.reserve(vs.Count() / 3);
         float x, y, z;
-        while(vs >> x >> y >> z)
+        while(vs.Read(x, y, z))
         {            
             VertexData.push_back(Vector3f(x, y, z));
         }
-        auto uvs = node.child("TexCoordData");
-        std::stringstream us;
-        us << uvs.text().as_string();
+        if(Binary != nullptr && node.child("TexCoordData").attribute("buffer"))
+        {
+            int buffer = node.child("TexCoordData").attribute("buffer").as_int();
+            if(!Binary->Read(buffer, UVData))
+            {
+                fprintf(stderr, "can't read TexCoordData buffer %d of the binary scene\n", buffer);
+                exit(1);
+            }
+        }
+        NumberReader us(node.child("TexCoordData").text().as_string());
+        UVData.reserve(us.Count() / 2);
         float u, v;
-        while(us >> u >> v)
+        while(us.Read(u, v))
         {
             UVData.push_back(Vector2f(u, v));
         }
@@ -186,26 +250,194 @@ namespace raytracer
                 Textures[id] = new DiffuseTexture(texture);
             }            
         }
+        decodes.wait();
+        for(auto light: Lights)
+        {
+            if(light->Type == LightType::Environment)
+                static_cast<EnvironmentLight*>(light)->BuildDistribution();
+        }
+    }
+
+    std::future<void> Scene::DecodeImages(pugi::xml_node node)
+    {
+        // image textures are filtered through mips, environment lights only read texels
+        std::vector<bool> mips(ResourceLocator::GetInstance()._images.size() + 1);
+        std::vector<int> used;
+        auto use = [&](int id, bool mipmapped)
+        {
+            if(id < 1 || id >= (int)mips.size())
+                return;
+            if(std::find(used.begin(), used.end(), id) == used.end())
+                used.push_back(id);
+            mips[id] = mips[id] || mipmapped;
+        };
+        for(auto& texture: node.child("Textures").children("TextureMap"))
+        {
+            if(std::strcmp(texture.attribute("type").as_string(), "image") == 0)
+                use(texture.child("ImageId").text().as_int(), true);
+        }
+        for(auto& light: node.child("Lights").children("SphericalDirectionalLight"))
+        {
+            use(light.child("ImageId").text().as_int(), false);
+        }
+        // a few decoder threads outside the pool, mips split their rows over it
+        return std::async(std::launch::async, [used, mips]()
+        {
+            std::atomic<size_t> next(0);
+            auto decode = [&]()
+            {
+                for(size_t i = next++; i < used.size(); i = next++)
+                {
+                    auto image = ResourceLocator::GetInstance().GetImage(used[i]);
+                    if(mips[used[i]])
+                        image->BuildMips();
+                    else
+                        image->Load();
+                }
+            };
+            size_t threads = std::min<size_t>(used.size(), ThreadPool::Shared().Size());
+            std::vector<std::future<void>> workers;
+            for(size_t t = 1; t < threads; t++)
+                workers.push_back(std::async(std::launch::async, decode));
+            decode();
+            for(auto& worker: workers)
+                worker.wait();
+        });
     }
 
     void Scene::Load()
     {
+        // ply meshes read their files concurrently, each one also splits its parsing over the pool
+        std::vector<std::future<void>> reads;
+        for(auto obj: Objects)
+        {
+            auto mesh = dynamic_cast<Mesh*>(obj);
+            if(mesh != nullptr && !mesh->PlyFile.empty())
+                reads.push_back(std::async(std::launch::async, [mesh]() { mesh->ReadPly(); }));
+            else if(mesh != nullptr && Binary != nullptr)
+                mesh->ReadFaceBuffer(*Binary);
+        }
+        for(auto& read: reads)
+            read.wait();
+        // objects load on the pool, an instance is queued once its base mesh is done
+        std::vector<std::vector<size_t>> dependents(Objects.size());
+        std::vector<size_t> ready;
+        for(size_t i = 0; i < Objects.size(); i++)
+        {
+            auto instance = dynamic_cast<MeshInstance*>(Objects[i]);
+            Mesh* base = nullptr;
+            size_t b = 0;
+            for(; instance != nullptr && b < Objects.size(); b++)
+            {
+                if(Objects[b]->Id == instance->BaseMeshId)
+                {
+                    base = dynamic_cast<Mesh*>(Objects[b]);
+                    break;
+                }
+            }
+            if(base != nullptr)
+                dependents[b].push_back(i);
+            else
+                ready.push_back(i);
+        }
+        auto& pool = ThreadPool::Shared();
+        size_t remaining = Objects.size();
+        std::mutex lock;
+        std::condition_variable done;
+        std::function<void(size_t)> load = [&](size_t i)
+        {
+            Objects[i]->Load(*this);
+            for(auto d: dependents[i])
+                pool.Submit([&load, d]() { load(d); });
+            std::lock_guard<std::mutex> guard(lock);
+            if(--remaining == 0)
+                done.notify_one();
+        };
+        for(auto i: ready)
+            pool.Submit([&load, i]() { load(i); });
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            done.wait(guard, [&]() { return remaining == 0; });
+        }
         IHittable** hs = new IHittable*[Objects.size()];
         for (size_t i = 0; i < Objects.size(); i++)
         {
-            Objects[i]->Load(*this);
             hs[i] = Objects[i];
         }
         Root = new BVH(hs, Objects.size());
+
+        float radius = (Root->aabb.Bounds[1] - Root->aabb.Bounds[0]).norm() / 2;
+        std::vector<float> power;
+        for(auto light: Lights)
+        {
+            power.push_back(light->Power(radius));
+        }
+        LightDistribution = AliasTable(power);
+        Binary = nullptr;
     }
 
     bool Scene::RayCast(Ray& ray, RayHit& hit, float maxDist, bool closest)
     {
         auto ret = Root->Hit(ray, hit);
+        if(ret)
+            hit.Object->ToWorld(ray, hit);
         ray.Dist = hit.T;
         return ret;
     }
 
+    // where the offset rays cross the tangent plane of the hit, and the uv change
+    // that needs, solved against dp/du and dp/dv in the least squares sense
+    static void HitDifferentials(const Ray& ray, RayHit& hit)
+    {
+        const Vector3f& n = hit.Normal;
+        float d = n.dot(hit.Point);
+        float tx = (d - n.dot(ray.RxOrigin)) / n.dot(ray.RxDirection);
+        float ty = (d - n.dot(ray.RyOrigin)) / n.dot(ray.RyDirection);
+        if(!std::isfinite(tx) || !std::isfinite(ty))
+            return;
+        hit.HasDifferentials = true;
+        hit.dpdx = ray.RxOrigin + ray.RxDirection * tx - hit.Point;
+        hit.dpdy = ray.RyOrigin + ray.RyDirection * ty - hit.Point;
+        auto linear = hit.Object->LocalToWorld.linear();
+        Vector3f dpdu = linear * hit.TBN.col(0);
+        Vector3f dpdv = linear * hit.TBN.col(1);
+        float a00 = dpdu.dot(dpdu);
+        float a01 = dpdu.dot(dpdv);
+        float a11 = dpdv.dot(dpdv);
+        float inv = 1 / (a00 * a11 - a01 * a01);
+        float dudx = (a11 * dpdu.dot(hit.dpdx) - a01 * dpdv.dot(hit.dpdx)) * inv;
+        float dvdx = (a00 * dpdv.dot(hit.dpdx) - a01 * dpdu.dot(hit.dpdx)) * inv;
+        float dudy = (a11 * dpdu.dot(hit.dpdy) - a01 * dpdv.dot(hit.dpdy)) * inv;
+        float dvdy = (a00 * dpdv.dot(hit.dpdy) - a01 * dpdu.dot(hit.dpdy)) * inv;
+        // no uv parametrization, e.g. faces without texture coordinates
+        if(!std::isfinite(dudx) || !std::isfinite(dvdx) || !std::isfinite(dudy) || !std::isfinite(dvdy))
+            return;
+        hit.dudx = dudx;
+        hit.dvdx = dvdx;
+        hit.dudy = dudy;
+        hit.dvdy = dvdy;
+    }
+
+    // carries the offset rays over a mirror or refraction bounce off a locally flat
+    // surface, bend maps an incoming direction to the outgoing one
+    template<typename F>
+    static void BounceDifferentials(const Ray& in, const RayHit& hit, Ray& out, F bend)
+    {
+        if(!in.HasDifferentials || !hit.HasDifferentials)
+            return;
+        Vector3f base = bend(in.Direction);
+        Vector3f rx = bend(in.RxDirection);
+        Vector3f ry = bend(in.RyDirection);
+        if(!rx.allFinite() || !ry.allFinite())
+            return;
+        // relative to the main ray, so glossy perturbations carry over
+        out.HasDifferentials = true;
+        out.RxOrigin = out.Origin + hit.dpdx;
+        out.RyOrigin = out.Origin + hit.dpdy;
+        out.RxDirection = (out.Direction + rx - base).normalized();
+        out.RyDirection = (out.Direction + ry - base).normalized();
+    }
+
     Vector3f Scene::Trace(Ray& ray, Camera& cam, int depth, Vector2i& xy)
     {
         Vector3f color(0, 0, 0);
@@ -214,17 +446,26 @@ namespace raytracer
             return color;      
         if(RayCast(ray, hit, FLT_MAX, true))
         {
-            if(hit.Material.Type == 3)
+            if(ray.HasDifferentials)
+                HitDifferentials(ray, hit);
+            const Material& material = Materials[hit.MaterialIndex];
+            auto mirror = [&](const Vector3f& d) -> Vector3f
             {
-                Vector3f reflect = Reflect(ray.Direction, hit.Normal, hit.Material.Roughness);
-                ray = Ray(hit.Point + hit.Normal * ShadowRayEpsilon, reflect, ray.Time);
+                return d - 2 * d.dot(hit.Normal) * hit.Normal;
+            };
+            if(material.Type == 3)
+            {
+                Vector3f reflect = Reflect(ray.Direction, hit.Normal, material.Roughness);
+                Ray rray = Ray(hit.Point + hit.Normal * ShadowRayEpsilon, reflect, ray.Time);
+                BounceDifferentials(ray, hit, rray, mirror);
+                ray = rray;
                 auto cl = Trace(ray, cam, depth - 1, xy);
-                color = color + hit.Material.MirrorReflectance.cwiseProduct(cl);
+                color = color + material.MirrorReflectance.cwiseProduct(cl);
             }
-            else if(hit.Material.Type == 2)
+            else if(material.Type == 2)
             {
                 float n1 = ray.N; //from
-                float n2 = ray.N == 1 ? hit.Material.RefractionIndex : 1;//to
+                float n2 = ray.N == 1 ? material.RefractionIndex : 1;//to
                 float ctheta = -ray.Direction.dot(hit.Normal);
                 Vector3f normal = hit.Normal;
                 if(ctheta < 0) // flip normal
@@ -232,20 +473,21 @@ namespace raytracer
                     ctheta *= -1;
                     normal = normal * -1;
                 }
-                Vector3f reflect = Reflect(ray.Direction, normal, hit.Material.Roughness);
+                Vector3f reflect = Reflect(ray.Direction, normal, material.Roughness);
                 float cphi2 = 1 - (n1/n2)*(n1/n2)*(1 - ctheta*ctheta);
                 if(cphi2 < 0) // no reftrac
                 {
                     Ray rray = Ray(hit.Point + normal * ShadowRayEpsilon, reflect, ray.Time);
                     rray.N = ray.N;
+                    BounceDifferentials(ray, hit, rray, mirror);
                     Vector3f l1 = Trace(rray, cam, depth - 1, xy);
                     RayHit rmphit;
                     if(ray.N != 1)
                     {
                         RayCast(rray, rmphit, FLT_MAX, false);
-                        l1.x() = l1.x() * std::exp(hit.Material.AbsorptionCoefficient.x() * rmphit.T * -1);
-                        l1.y() = l1.y() * std::exp(hit.Material.AbsorptionCoefficient.y() * rmphit.T * -1);
-                        l1.z() = l1.z() * std::exp(hit.Material.AbsorptionCoefficient.z() * rmphit.T * -1);
+                        l1.x() = l1.x() * std::exp(material.AbsorptionCoefficient.x() * rmphit.T * -1);
+                        l1.y() = l1.y() * std::exp(material.AbsorptionCoefficient.y() * rmphit.T * -1);
+                        l1.z() = l1.z() * std::exp(material.AbsorptionCoefficient.z() * rmphit.T * -1);
                     }
                     color = color + l1;
                 }
@@ -260,9 +502,17 @@ namespace raytracer
                     float ft = 1 - fr;
                     Ray rray = Ray(hit.Point + normal * ShadowRayEpsilon, reflect, ray.Time);
                     rray.N = ray.N;
+                    BounceDifferentials(ray, hit, rray, mirror);
                     Vector3f l1 = Trace(rray, cam, depth - 1, xy) * fr;
                     Ray tray = Ray(hit.Point - normal * ShadowRayEpsilon, reftrac, ray.Time);
                     tray.N = n2;
+                    BounceDifferentials(ray, hit, tray, [&](const Vector3f& d) -> Vector3f
+                    {
+                        // nan past the critical angle, which drops the differentials
+                        float c = -d.dot(normal);
+                        float eta = n1 / n2;
+                        return (d + normal * c) * eta - normal * std::sqrt(1 - eta * eta * (1 - c * c));
+                    });
                     Vector3f l0 = Trace(tray, cam, depth - 1, xy) * ft;
                     RayHit tmphit, rmphit;
                     if(ray.N == 1)
@@ -270,52 +520,47 @@ namespace raytracer
                         // reftracing into dielectric
                         // apply beer law for reftracted val
                         RayCast(tray, tmphit, FLT_MAX, false);
-                        l0.x() = l0.x() * std::exp(hit.Material.AbsorptionCoefficient.x() * tmphit.T * -1);
-                        l0.y() = l0.y() * std::exp(hit.Material.AbsorptionCoefficient.y() * tmphit.T * -1);
-                        l0.z() = l0.z() * std::exp(hit.Material.AbsorptionCoefficient.z() * tmphit.T * -1);
+                        l0.x() = l0.x() * std::exp(material.AbsorptionCoefficient.x() * tmphit.T * -1);
+                        l0.y() = l0.y() * std::exp(material.AbsorptionCoefficient.y() * tmphit.T * -1);
+                        l0.z() = l0.z() * std::exp(material.AbsorptionCoefficient.z() * tmphit.T * -1);
                     }
                     else
                     {
                         // reftracting into vacuum
                         // apply beer law for reflected val
                         RayCast(rray, rmphit, FLT_MAX, false);
-                        l1.x() = l1.x() * std::exp(hit.Material.AbsorptionCoefficient.x() * rmphit.T * -1);
-                        l1.y() = l1.y() * std::exp(hit.Material.AbsorptionCoefficient.y() * rmphit.T * -1);
-                        l1.z() = l1.z() * std::exp(hit.Material.AbsorptionCoefficient.z() * rmphit.T * -1);
+                        l1.x() = l1.x() * std::exp(material.AbsorptionCoefficient.x() * rmphit.T * -1);
+                        l1.y() = l1.y() * std::exp(material.AbsorptionCoefficient.y() * rmphit.T * -1);
+                        l1.z() = l1.z() * std::exp(material.AbsorptionCoefficient.z() * rmphit.T * -1);
                     }                    
                     color = color + l0 + l1;
                 }                
             }
-            else if(hit.Material.Type == 1)
+            else if(material.Type == 1)
             {
-                Vector3f reflect = Reflect(ray.Direction, hit.Normal, hit.Material.Roughness);
+                Vector3f reflect = Reflect(ray.Direction, hit.Normal, material.Roughness);
                 float ndi = -hit.Normal.dot(ray.Direction);
-                float n = hit.Material.RefractionIndex;
-                float k = hit.Material.AbsorptionIndex;
-                float rs = ((n*n + k*k) - 2 * n * ndi + ndi * ndi) / ((n*n + k*k) + 2 * n * ndi + ndi * ndi);
-                float rp = ((n*n + k*k) * ndi*ndi - 2*n*ndi + 1) / ((n*n + k*k) * ndi*ndi + 2*n*ndi + 1);
-                float fr = (rs + rp) / 2;
+                float fr = material.Fresnel(ndi);
                 Ray rray = Ray(hit.Point + hit.Normal * ShadowRayEpsilon, reflect, ray.Time);
+                BounceDifferentials(ray, hit, rray, mirror);
                 auto cl = Trace(rray, cam, depth - 1, xy);
-                color = color + hit.Material.MirrorReflectance.cwiseProduct(cl) * fr;
+                color = color + material.MirrorReflectance.cwiseProduct(cl) * fr;
             }
 
             if(ray.N != 1)
                 return color;
 
-            auto ls = dynamic_cast<LightSphere*>(hit.Object);
-            auto lm = dynamic_cast<LightMesh*>(hit.Object);
-            if(ls != nullptr)
+            if(hit.Object->Type == HittableType::LightSphere)
             {
-                color += ls->Radiance;
+                color += static_cast<LightSphere*>(hit.Object)->Radiance;
             }
-            else if(lm != nullptr)
+            else if(hit.Object->Type == HittableType::LightMesh)
             {
-                color += lm->Radiance;
+                color += static_cast<LightMesh*>(hit.Object)->Radiance;
             }
             else
             {
-                color += hit.Material.Shade(*this, ray, hit, cam.Gamma);
+                color += material.Shade(*this, ray, hit, cam.Index);
             }            
         }
         else
@@ -341,77 +586,315 @@ namespace raytracer
 
     void Scene::Render(int numThreads)
     {
+        // tiles of all cameras share one queue, so threads never wait for a camera
+        // to finish, and each image is written as soon as its last tile is done
+        const int tileSize = 32;
+        struct Job
+        {
+            Camera* Cam;
+            std::vector<Vector3f> Pixels;
+            std::atomic<int> Remaining;
+        };
+        std::vector<std::unique_ptr<Job>> jobs;
+        std::vector<std::future<void>> tiles;
+        std::vector<std::future<void>> outputs;
+        std::mutex outputLock;
+        auto& pool = ThreadPool::Shared();
         for(auto& cam: Cameras)
         {
-            std::vector<unsigned char> pixels;
-            std::vector<Vector3f> fpixels;
-            if(cam.Tonemap)
+            if(cam.Progressive)
+                continue;
+            int width = cam.ImageResolution.x();
+            int height = cam.ImageResolution.y();
+            int tx = (width + tileSize - 1) / tileSize;
+            int ty = (height + tileSize - 1) / tileSize;
+            jobs.emplace_back(new Job());
+            Job* job = jobs.back().get();
+            job->Cam = &cam;
+            job->Pixels.resize(width * height);
+            job->Remaining = tx * ty;
+            for(int j = 0; j < ty; j++)
+            {
+                for(int i = 0; i < tx; i++)
+                {
+                    tiles.push_back(pool.Submit([=, &outputs, &outputLock]()
+                    {
+                        int x0 = i * tileSize;
+                        int y0 = j * tileSize;
+                        int x1 = std::min(x0 + tileSize, width);
+                        int y1 = std::min(y0 + tileSize, height);
+                        TracePixels(*job->Cam, x0, y0, x1, y1, &job->Pixels[y0 * width + x0], width);
+                        if(--job->Remaining == 0)
+                        {
+                            std::lock_guard<std::mutex> lock(outputLock);
+                            outputs.push_back(std::async(std::launch::async, [this, job]()
+                            {
+                                WriteImage(*job->Cam, job->Pixels);
+                            }));
+                        }
+                    }));
+                }
+            }
+        }
+        // tiles refer to the jobs, so all of them finish before an exception from
+        // one is passed on; outputs are std::async futures and wait when destroyed
+        for(auto& tile: tiles)
+            tile.wait();
+        for(auto& tile: tiles)
+            tile.get();
+        for(auto& cam: Cameras)
+        {
+            if(cam.Progressive)
+                RenderProgressive(cam);
+        }
+        for(auto& output: outputs)
+            output.get();
+    }
+
+    void Scene::TracePixels(Camera& cam, int x0, int y0, int x1, int y1, Vector3f* out, int stride)
+    {
+        for(int y = y0; y < y1; y++)
+        {
+            for(int x = x0; x < x1; x++)
+            {
+                Random::Thread().Seed(y * cam.ImageResolution.x() + x, 0);
+                auto rays = cam.GetRay(x, y);
+                Vector3f cl = Vector3f::Zero();
+                Vector2i xy(x, y);
+                for(int r = 0; r < rays.size(); r++)
+                {                                
+                    cl += Trace(rays[r], cam, MaxRecursionDepth, xy);
+                }
+                out[(y - y0) * stride + (x - x0)] = cl / rays.size();
+            }
+        }
+    }
+
+    std::vector<Vector3f> Scene::RenderTile(Camera& cam, int x0, int y0, int x1, int y1, int cores)
+    {
+        int width = x1 - x0;
+        int height = y1 - y0;
+        std::vector<Vector3f> fpixels(width * height);
+        std::atomic<int> count(0);
+        ThreadPool::Shared().Run(std::min(cores, ThreadPool::Shared().Size()), [&]()
+        {
+            while(true)
             {
-                fpixels.resize(cam.ImageResolution.x() * cam.ImageResolution.y());
+                int row = count++;
+                if(row >= height)
+                    break;
+                TracePixels(cam, x0, y0 + row, x1, y0 + row + 1, &fpixels[row * width], width);
             }
-            else
+        });
+        return fpixels;
+    }
+
+    void Scene::RenderProgressive(Camera& cam)
+    {
+        int width = cam.ImageResolution.x();
+        int height = cam.ImageResolution.y();
+        int size = width * height;
+        const int minSamples = 16;
+        Accumulator acc(width, height);
+        acc.SampleCount = cam.SampleCount;
+        acc.NoiseThreshold = cam.NoiseThreshold;
+        acc.Scene = Hash;
+        auto checkpoint = cam.ImageName + ".ckpt";
+        if(Resume && acc.Load(checkpoint))
+        {
+            std::cout << "resuming " << cam.ImageName << " at pass " << acc.Pass << std::endl;
+        }
+        else if(Resume && access(checkpoint.c_str(), F_OK) == 0)
+        {
+            std::cerr << "not resuming from " << checkpoint << ", it was written for another scene or settings" << std::endl;
+        }
+
+        // the time limit covers the earlier runs of a resumed render
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<float>(cam.TimeLimit - acc.Elapsed));
+        auto lastSnapshot = start;
+        auto lastCheckpoint = start;
+        float elapsed = acc.Elapsed;
+        std::atomic<bool> expired(false);
+
+        // the first pass visits a coarse grid first and refines it, so running out of
+        // time inside it still leaves an evenly covered image
+        const int coarse = 8;
+        std::vector<int> order;
+        order.reserve(size);
+        for(int step = coarse; step >= 1; step /= 2)
+        {
+            for(int y = 0; y < height; y += step)
             {
-                pixels.resize(cam.ImageResolution.x() * cam.ImageResolution.y() * 4);
+                for(int x = 0; x < width; x += step)
+                {
+                    if(step != coarse && x % (2 * step) == 0 && y % (2 * step) == 0)
+                        continue;
+                    order.push_back(y * width + x);
+                }
             }
-            int size = cam.ImageResolution.x() * cam.ImageResolution.y();
-            int cores = std::thread::hardware_concurrency();
-            volatile std::atomic<int> count(0);
-            std::vector<std::future<void>> futures;
-            while(cores--)
+        }
+
+        auto resolve = [&]()
+        {
+            std::vector<Vector3f> fpixels(size, Vector3f::Zero());
+            for(int i = 0; i < size; i++)
             {
-                futures.emplace_back(
-                    std::async([=, &count, &cam, &pixels, &fpixels]()
+                if(acc.Counts[i] > 0)
+                {
+                    fpixels[i] = acc.Resolve(i);
+                    continue;
+                }
+                // not reached yet, reuse the closest coarser grid pixel
+                int x = i % width;
+                int y = i / width;
+                for(int step = 2; step <= coarse; step *= 2)
+                {
+                    int j = (y - y % step) * width + (x - x % step);
+                    if(acc.Counts[j] > 0)
                     {
-                        while(true)
-                        {
-                            int index = count++;
-                            if(index >= size)
-                                break;
-                            int x = index % cam.ImageResolution.x();
-                            int y = index / cam.ImageResolution.x();                            
-                            auto rays = cam.GetRay(x, y);
-                            Vector3f cl = Vector3f::Zero();
-                            Vector2i xy(x, y);
-                            for(int r = 0; r < rays.size(); r++)
-                            {                                
-                                cl += Trace(rays[r], cam, MaxRecursionDepth, xy);
-                            }
-                            cl /= rays.size();
-                            if(cam.Tonemap)
-                            {
-                                fpixels[index] = cl;
-                            }
-                            else
-                            {                            
-                                pixels[4 * index] = cl.x() > 255 ? 255 : cl.x();
-                                pixels[4 * index + 1] = cl.y() > 255 ? 255 : cl.y();
-                                pixels[4 * index + 2] = cl.z() > 255 ? 255 : cl.z();
-                                pixels[4 * index + 3] = 255;
-                            }
-                        }
+                        fpixels[i] = acc.Resolve(j);
+                        break;
+                    }
+                }
+            }
+            return fpixels;
+        };
+
+        auto save = [&](std::chrono::steady_clock::time_point now)
+        {
+            acc.Elapsed = elapsed + std::chrono::duration<float>(now - start).count();
+            if(!acc.Save(checkpoint))
+                std::cout << "failed to write checkpoint " << checkpoint << std::endl;
+            lastCheckpoint = now;
+        };
+
+        bool finished = true;
+        for(; acc.Pass < cam.SampleCount; acc.Pass++)
+        {
+            int pass = acc.Pass;
+            std::atomic<int> count(0);
+            ThreadPool::Shared().Run(ThreadPool::Shared().Size(), [&]()
+            {
+                while(true)
+                {
+                    int index = count++;
+                    if(index >= size)
+                        break;
+                    if(pass == 0)
+                        index = order[index];
+                    // converged, or already sampled before an interrupted run
+                    if(acc.Converged[index] || acc.Counts[index] > pass)
+                        continue;
+                    if(cam.TimeLimit > 0 && std::chrono::steady_clock::now() >= deadline)
+                    {
+                        expired = true;
+                        break;
                     }
-                    )
-                );
+                    int x = index % width;
+                    int y = index / width;
+                    Vector2i xy(x, y);
+                    Random::Thread().Seed(index, acc.Counts[index]);
+                    auto ray = cam.GetSample(x, y);
+                    acc.Add(index, Trace(ray, cam, MaxRecursionDepth, xy));
+                }
+            });
+            if(expired)
+            {
+                finished = false;
+                break;
+            }
+
+            if(cam.NoiseThreshold > 0)
+            {
+                int active = 0;
+                for(int i = 0; i < size; i++)
+                {
+                    if(acc.Counts[i] >= minSamples)
+                        acc.Converged[i] = acc.RelativeError(i) < cam.NoiseThreshold;
+                    active += !acc.Converged[i];
+                }
+                if(active == 0)
+                {
+                    acc.Pass++;
+                    break;
+                }
             }
-            futures.clear();
-            if(!cam.Tonemap)
+
+            auto now = std::chrono::steady_clock::now();
+            if(cam.SnapshotInterval > 0 && std::chrono::duration<float>(now - lastSnapshot).count() >= cam.SnapshotInterval)
             {
-                std::vector<unsigned char> png;
-                lodepng::encode(png, pixels, cam.ImageResolution.x(), cam.ImageResolution.y());
-                lodepng::save_file(png, cam.ImageName);
+                auto fpixels = resolve();
+                WriteImage(cam, fpixels, true);
+                lastSnapshot = now;
             }
-            else
+            if(cam.CheckpointInterval > 0 && std::chrono::duration<float>(now - lastCheckpoint).count() >= cam.CheckpointInterval)
             {
-                WriteEXR(fpixels, cam.ImageResolution.x(), cam.ImageResolution.y(), cam.ImageName.c_str());
-                // tonemap
-                std::vector<unsigned char> px;
-                px.resize(fpixels.size() * 4);
-                cam.toneMapper->Map(fpixels, px);
-                std::vector<unsigned char> png;
-                lodepng::encode(png, px, cam.ImageResolution.x(), cam.ImageResolution.y());
-                lodepng::save_file(png, cam.ImageName.append(".png"));
-            }            
-        }            
+                save(now);
+            }
+        }
+        auto now = std::chrono::steady_clock::now();
+        if(!finished && cam.CheckpointInterval > 0)
+        {
+            save(now);
+        }
+        else if(finished)
+        {
+            std::remove(checkpoint.c_str());
+        }
+        std::cout << cam.ImageName << ": " << acc.Pass << " passes in " 
+            << elapsed + std::chrono::duration<float>(now - start).count() << " s" << std::endl;
+        auto fpixels = resolve();
+        WriteImage(cam, fpixels);
+    }
+
+    void Scene::WriteImage(Camera& cam, std::vector<Vector3f>& fpixels, bool snapshot)
+    {
+        // written next to the target and renamed, so a run killed while writing a
+        // snapshot still leaves the previous complete image
+        auto replace = [](const std::string& name, const std::function<void(const std::string&)>& write)
+        {
+            auto tmp = name + ".tmp";
+            write(tmp);
+            if(std::rename(tmp.c_str(), name.c_str()) != 0)
+            {
+                std::cerr << "can't write " << name << std::endl;
+                std::remove(tmp.c_str());
+            }
+        };
+        if(!cam.Tonemap)
+        {
+            std::vector<unsigned char> pixels(fpixels.size() * 4);
+            for(int i = 0; i < (int)fpixels.size(); i++)
+            {
+                auto& cl = fpixels[i];
+                pixels[4 * i] = cl.x() > 255 ? 255 : cl.x();
+                pixels[4 * i + 1] = cl.y() > 255 ? 255 : cl.y();
+                pixels[4 * i + 2] = cl.z() > 255 ? 255 : cl.z();
+                pixels[4 * i + 3] = 255;
+            }
+            replace(cam.ImageName, [&](const std::string& name)
+            {
+                WritePNG(pixels, cam.ImageResolution.x(), cam.ImageResolution.y(), name);
+            });
+        }
+        else
+        {
+            replace(cam.ImageName, [&](const std::string& name)
+            {
+                WriteEXR(fpixels, cam.ImageResolution.x(), cam.ImageResolution.y(), name.c_str(), cam.ExrCompression);
+            });
+            // tonemap
+            std::vector<unsigned char> px;
+            px.resize(fpixels.size() * 4);
+            // snapshots are replaced soon, so they always take the fast path
+            cam.toneMapper->Map(fpixels, px, snapshot ? TonemapAccuracy::Fast : cam.Accuracy);
+            replace(cam.ImageName + ".png", [&](const std::string& name)
+            {
+                WritePNG(px, cam.ImageResolution.x(), cam.ImageResolution.y(), name);
+            });
+        }
     }
 
     std::ostream& operator<<(std::ostream& os, const Scene& scene)
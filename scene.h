@@ -9,8 +9,11 @@
 #include "Eigen/Dense"
 #include <vector>
 #include <unordered_map>
+#include <future>
 #include "resourcelocator.h"
 #include "objectlight.h"
+#include "distribution.h"
+#include "binaryscene.h"
 
 using namespace Eigen;
 
@@ -19,9 +22,12 @@ namespace raytracer
     class Scene
     {
         public:
-            Scene(pugi::xml_node node);
+            Scene(pugi::xml_node node, const BinaryScene* binary = nullptr);
             void Load();
             void Render(int numThreads);
+            std::vector<Vector3f> RenderTile(Camera& cam, int x0, int y0, int x1, int y1, int cores);
+            void RenderProgressive(Camera& cam);
+            void WriteImage(Camera& cam, std::vector<Vector3f>& fpixels, bool snapshot = false);
             bool RayCast(Ray& ray, RayHit& hit, float maxDist, bool closest);
             Vector3f BackgroundColor;
             float ShadowRayEpsilon;
@@ -31,6 +37,8 @@ namespace raytracer
             AmbientLight ambientLight;
             EnvironmentLight* environmentLight;
             std::vector<Light*> Lights;
+            AliasTable LightDistribution;
+            int LightSamples;
             std::vector<Material> Materials;
             std::vector<Vector3f> VertexData;
             std::vector<Vector2f> UVData;
@@ -42,9 +50,19 @@ namespace raytracer
             std::vector<Transform<float, 3, Affine>> Composite;
             BackgroundTexture* BackTexture = nullptr;
             std::unordered_map<int, Texture*> Textures;
+            bool Resume = false;
+            // hash of the scene description, set when a camera is progressive,
+            // so a checkpoint only resumes the scene it was written for
+            uint64_t Hash = 0;
+            // bulk buffers of a binary scene, only valid until Load returns
+            const BinaryScene* Binary = nullptr;
 
             friend std::ostream& operator<<(std::ostream& os, const Scene& scene);
         private:
+            // starts decoding the images the scene uses, mipmapped when a texture samples them
+            static std::future<void> DecodeImages(pugi::xml_node node);
             Vector3f Trace(Ray& ray, Camera& cam, int depth, Vector2i& xy);
+            // out holds rows of stride pixels, starting at (x0, y0)
+            void TracePixels(Camera& cam, int x0, int y0, int x1, int y1, Vector3f* out, int stride);
     };
 }
\ No newline at end of file
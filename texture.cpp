@@ -1,91 +1,328 @@
 #include "texture.h"
 #include<iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <thread>
+#include <sstream>
+#include <cerrno>
+#include <sys/file.h>
+#include "threadpool.h"
 #define TINYEXR_IMPLEMENTATION
+#define TINYEXR_USE_THREAD 1
 #include "tinyexr.h"
 
 namespace raytracer{
 
+    // channel value as a float and back, 8 bit values stay 0-255 and are rounded
+    template<typename T> struct Channel;
+    template<> struct Channel<uint8_t>
+    {
+        static float Get(uint8_t v) { return v; }
+        static uint8_t Put(float v) { return (uint8_t)std::min(std::max(v + 0.5f, 0.0f), 255.0f); }
+    };
+    template<> struct Channel<uint16_t>
+    {
+        static float Get(uint16_t v) { return HalfToFloat(v); }
+        static uint16_t Put(float v) { return FloatToHalf(v); }
+    };
+    template<> struct Channel<float>
+    {
+        static float Get(float v) { return v; }
+        static float Put(float v) { return v; }
+    };
+
+    template<typename T, typename S>
+    static void Convert(const S* in, size_t count, unsigned char* out)
+    {
+        T* texels = reinterpret_cast<T*>(out);
+        for(size_t i = 0; i < 4 * count; i++)
+            texels[i] = Channel<T>::Put(Channel<S>::Get(in[i]));
+    }
+
     Image::Image(pugi::xml_node node)
     {
-        auto name = std::string(node.text().as_string());
-        int npos = name.find_last_of('.');
-        auto extension = name.substr(npos + 1);
-        if(extension.compare("png") == 0)
+        _path = std::string(node.text().as_string());
+        _extension = _path.substr(_path.find_last_of('.') + 1);
+        _cached = TextureCache::Shared().Enabled();
+        // the decoder's format unless the image asks for another one, known
+        // before anything is read so samplers can be picked up front
+        Format = _extension.compare("exr") == 0 ? TexelFormat::RGBA32F : TexelFormat::RGBA8;
+        auto format = std::string(node.attribute("format").as_string());
+        if(format.compare("RGBA8") == 0)
+            Format = TexelFormat::RGBA8;
+        else if(format.compare("RGBA16F") == 0)
+            Format = TexelFormat::RGBA16F;
+        else if(format.compare("RGBA32F") == 0)
+            Format = TexelFormat::RGBA32F;
+        _texelSize = Format == TexelFormat::RGBA8 ? 4 : Format == TexelFormat::RGBA16F ? 8 : 16;
+    }
+
+    void Image::Load()
+    {
+        std::call_once(_loaded, [this]() { decode(); });
+    }
+
+    Image::Level Image::newLevel(unsigned width, unsigned height)
+    {
+        Level level;
+        level.Width = width;
+        level.Height = height;
+        level.TilesX = (width + TileSize - 1) / TileSize;
+        unsigned tilesY = (height + TileSize - 1) / TileSize;
+        size_t bytes = (size_t)level.TilesX * tilesY * tileBytes();
+        if(_cached)
+        {
+            level.First = TextureCache::Shared().Reserve(bytes);
+        }
+        else
+        {
+            level.First = _tiles.size();
+            _tiles.resize(_tiles.size() + bytes);
+        }
+        return level;
+    }
+
+    template<typename R>
+    void Image::storeStrip(const Level& level, unsigned strip, R row)
+    {
+        // cached strips are tiled in a buffer of one tile row and handed over
+        size_t bytes = (size_t)level.TilesX * tileBytes();
+        uint64_t first = level.First + strip * bytes;
+        std::vector<unsigned char> buffer(_cached ? bytes : 0);
+        unsigned char* tiles = _cached ? buffer.data() : &_tiles[first];
+        std::vector<unsigned char> texels(level.Width * _texelSize);
+        unsigned y1 = std::min((strip + 1) * TileSize, level.Height);
+        for(unsigned y = strip * TileSize; y < y1; y++)
         {
-            stride = 4;
-            Mode = ImageMode::RGBA;
-            auto code = lodepng::decode(Pixels, Width, Height, name);
-            std::cout << lodepng_error_text(code) << std::endl;
+            row(y, texels.data());
+            for(unsigned tx = 0; tx < level.TilesX; tx++)
+            {
+                unsigned x = tx * TileSize;
+                std::memcpy(&tiles[tx * tileBytes() + (y % TileSize) * TileSize * _texelSize], &texels[x * _texelSize],
+                    std::min<unsigned>(TileSize, level.Width - x) * _texelSize);
+            }
+        }
+        if(_cached)
+            TextureCache::Shared().Write(first, tiles, bytes);
+    }
+
+    void Image::decode()
+    {
+        // with the cache on, the decoder output is the only full size buffer, and
+        // one image at a time keeps it to one image beyond the budget
+        static std::mutex cachedDecode;
+        std::unique_lock<std::mutex> lock(cachedDecode, std::defer_lock);
+        if(_cached)
+            lock.lock();
+        auto name = _path.c_str();
+        // decoders give 8 bit gray, rgb or rgba, or float rgba
+        std::vector<unsigned char> rgba8;
+        int channels = 4;
+        float* rgba32 = nullptr;
+        if(_extension.compare("png") == 0)
+        {
+            auto code = lodepng::decode(rgba8, Width, Height, _path);
+            if(code != 0)
+            {
+                fprintf(stderr, "can't read image %s: %s\n", name, lodepng_error_text(code));
+                exit(1);
+            }
         }
-        else if(extension.compare("jpg") == 0)
+        else if(_extension.compare("jpg") == 0)
         {
-            Mode = ImageMode::RGB;
             int mode;
-            read_jpeg_header(name.c_str(), Width, Height, mode);   
+            read_jpeg_header(name, Width, Height, mode);
             if(mode == 0)
             {
-                Mode = ImageMode::GRAYSCALE;
-                stride = 1;
+                channels = 1;
             }
             else if(mode == 1)
             {
-                Mode = ImageMode::RGB;
-                stride = 3;
+                channels = 3;
             }
             else
             {
-                std::cout << "UNSUPPORTED JPG FORMAT!" << std::endl;
-                exit(0);
-            }            
-            Pixels.resize(Height * Width * stride);
-            read_jpeg(name.c_str(), Pixels, Width, Height);     
+                fprintf(stderr, "can't read image %s: unsupported jpg color space\n", name);
+                exit(1);
+            }
+            rgba8.resize((size_t)Width * Height * channels);
+            read_jpeg(name, rgba8, Width, Height);
         }
-        else if(extension.compare("exr") == 0)
+        else if(_extension.compare("exr") == 0)
         {
-            stride = 4;
-            Mode = ImageMode::HDR;
-            float* out; // width * height * RGBA
             const char* err = nullptr;
             int w, h;
-            LoadEXR(&out, &w, &h, name.c_str(), &err);
+            if(LoadEXR(&rgba32, &w, &h, name, &err) != TINYEXR_SUCCESS)
+            {
+                fprintf(stderr, "can't read image %s: %s\n", name, err != nullptr ? err : "invalid exr");
+                exit(1);
+            }
             Width = w;
             Height = h;
-            _hdr = new Hdr();
-            _hdr->Pixels = out;
         }
         else
         {
-            std::cout << "UNSUPPORTED IMAGE FORMAT!" << std::endl;
+            fprintf(stderr, "can't read image %s: unsupported image format\n", name);
+            exit(1);
+        }
+
+        if(!_cached)
+        {
+            // room for the whole pyramid, so adding mip levels never moves the tiles
+            size_t bytes = 0;
+            for(unsigned w = Width, h = Height; w > 0 && h > 0; w = (w + 1) / 2, h = (h + 1) / 2)
+            {
+                bytes += (size_t)((w + TileSize - 1) / TileSize) * ((h + TileSize - 1) / TileSize) * tileBytes();
+                if(w == 1 && h == 1)
+                    break;
+            }
+            _tiles.reserve(bytes);
         }
+
+        // rows are converted to Format as they are tiled
+        bool floats = rgba32 != nullptr;
+        std::vector<unsigned char> expanded(channels != 4 ? Width * 4 : 0);
+        auto row = [&](unsigned y, unsigned char* out)
+        {
+            if(floats)
+            {
+                const float* in = rgba32 + (size_t)y * Width * 4;
+                if(Format == TexelFormat::RGBA32F)
+                    std::memcpy(out, in, Width * _texelSize);
+                else if(Format == TexelFormat::RGBA16F)
+                    Convert<uint16_t>(in, Width, out);
+                else
+                    Convert<uint8_t>(in, Width, out);
+                return;
+            }
+            const unsigned char* in = &rgba8[(size_t)y * Width * channels];
+            if(channels != 4)
+            {
+                // grayscale is spread over rgb
+                for(unsigned x = 0; x < Width; x++)
+                {
+                    for(int c = 0; c < 3; c++)
+                        expanded[4 * x + c] = in[channels * x + (channels == 1 ? 0 : c)];
+                    expanded[4 * x + 3] = 255;
+                }
+                in = expanded.data();
+            }
+            if(Format == TexelFormat::RGBA8)
+                std::memcpy(out, in, Width * _texelSize);
+            else if(Format == TexelFormat::RGBA16F)
+                Convert<uint16_t>(in, Width, out);
+            else
+                Convert<float>(in, Width, out);
+        };
+        auto level = newLevel(Width, Height);
+        for(unsigned s = 0; s * TileSize < Height; s++)
+            storeStrip(level, s, row);
+        _levels.push_back(level);
+        free(rgba32);
     }
 
-    Vector3f Image::Fetch(int x, int y)
+    template<typename T>
+    static Vector3f Rgb(const T* t)
     {
-        if(x >= Width)
-            x = Width - 1;
-        if(y >= Height)
-            y = Height - 1;
-        Vector3f p;
-        int o = stride * y * Width + stride * x;
-        if(Mode == RGB || Mode == RGBA)
+        return Vector3f(Channel<T>::Get(t[0]), Channel<T>::Get(t[1]), Channel<T>::Get(t[2]));
+    }
+
+    Vector3f Image::Fetch(int level, int x, int y)
+    {
+        switch(Format)
         {
-            p.x() = Pixels[o];
-            p.y() = Pixels[o + 1];
-            p.z() = Pixels[o + 2];
+            case TexelFormat::RGBA16F: return Rgb(Texel<uint16_t>(level, x, y));
+            case TexelFormat::RGBA32F: return Rgb(Texel<float>(level, x, y));
+            default: return Rgb(Texel<uint8_t>(level, x, y));
         }
-        else if(Mode == HDR)
+    }
+
+    void Image::readRow(int level, unsigned y, unsigned char* out)
+    {
+        auto& l = _levels[level];
+        for(unsigned tx = 0; tx < l.TilesX; tx++)
         {
-            p.x() = _hdr->Pixels[o];
-            p.y() = _hdr->Pixels[o + 1];
-            p.z() = _hdr->Pixels[o + 2];
+            unsigned x = tx * TileSize;
+            const unsigned char* tile = tileData(l.First + ((y / TileSize) * l.TilesX + tx) * tileBytes());
+            std::memcpy(out + x * _texelSize, tile + (y % TileSize) * TileSize * _texelSize,
+                std::min<unsigned>(TileSize, l.Width - x) * _texelSize);
         }
-        else
+    }
+
+    // averages 2x2 texels of two source rows, odd sizes repeat the last column
+    template<typename T>
+    static void DownsampleRow(const unsigned char* row0, const unsigned char* row1, unsigned char* row,
+        unsigned width, unsigned outWidth)
+    {
+        auto r0 = reinterpret_cast<const T*>(row0);
+        auto r1 = reinterpret_cast<const T*>(row1);
+        auto out = reinterpret_cast<T*>(row);
+        for(unsigned x = 0; x < outWidth; x++)
         {
-            p.x() = Pixels[o];
-            p.y() = Pixels[o];
-            p.z() = Pixels[o];            
-        }        
-        return p;
+            unsigned x0 = 2 * x * 4;
+            unsigned x1 = std::min(2 * x + 1, width - 1) * 4;
+            for(int c = 0; c < 4; c++)
+            {
+                float sum = Channel<T>::Get(r0[x0 + c]) + Channel<T>::Get(r0[x1 + c])
+                    + Channel<T>::Get(r1[x0 + c]) + Channel<T>::Get(r1[x1 + c]);
+                out[x * 4 + c] = Channel<T>::Put(sum / 4);
+            }
+        }
+    }
+
+    void Image::BuildMips()
+    {
+        Load();
+        std::call_once(_mipsBuilt, [this]()
+        {
+            unsigned w = Width;
+            unsigned h = Height;
+            while(w > 1 || h > 1)
+            {
+                unsigned mw = std::max(1u, (w + 1) / 2);
+                unsigned mh = std::max(1u, (h + 1) / 2);
+                int source = _levels.size() - 1;
+                auto level = newLevel(mw, mh);
+                ThreadPool::Shared().For((mh + TileSize - 1) / TileSize, 1, [&](size_t begin, size_t end)
+                {
+                    std::vector<unsigned char> r0(w * _texelSize);
+                    std::vector<unsigned char> r1(w * _texelSize);
+                    for(unsigned s = begin; s < end; s++)
+                    {
+                        storeStrip(level, s, [&](unsigned y, unsigned char* out)
+                        {
+                            readRow(source, 2 * y, r0.data());
+                            readRow(source, std::min(2 * y + 1, h - 1), r1.data());
+                            if(Format == TexelFormat::RGBA16F)
+                                DownsampleRow<uint16_t>(r0.data(), r1.data(), out, w, mw);
+                            else if(Format == TexelFormat::RGBA32F)
+                                DownsampleRow<float>(r0.data(), r1.data(), out, w, mw);
+                            else
+                                DownsampleRow<uint8_t>(r0.data(), r1.data(), out, w, mw);
+                        });
+                    }
+                });
+                _levels.push_back(level);
+                w = mw;
+                h = mh;
+            }
+        });
+    }
+
+    ImageSampler* ImageSampler::Create(pugi::xml_node node)
+    {
+        auto image = ResourceLocator::GetInstance().GetImage(node.child("ImageId").text().as_int());
+        switch(image->Format)
+        {
+            case TexelFormat::RGBA16F: return new TypedImageSampler<TexelFormat::RGBA16F>(node);
+            case TexelFormat::RGBA32F: return new TypedImageSampler<TexelFormat::RGBA32F>(node);
+            default: return new TypedImageSampler<TexelFormat::RGBA8>(node);
+        }
     }
 
     ImageSampler::ImageSampler(pugi::xml_node node)
@@ -101,38 +338,103 @@ namespace raytracer{
         }
         Normalizer = node.child("Normalizer").text().as_float(255);
         int id = node.child("ImageId").text().as_int();
+        // the scene decodes the image and builds its mips, see Scene::Scene
         Image = ResourceLocator::GetInstance().GetImage(id);
+        bool degamma = node.attribute("degamma").as_bool(false);
+        for(int i = 0; i < 256; i++)
+        {
+            float c = i / 255.0f;
+            _decode[i] = !degamma ? i : 255 * (c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f));
+        }
+    }
+
+    template<>
+    Vector4f TypedImageSampler<TexelFormat::RGBA8>::fetch(int level, int x, int y)
+    {
+        auto t = Image->Texel<uint8_t>(level, x, y);
+        return Vector4f(_decode[t[0]], _decode[t[1]], _decode[t[2]], _decode[t[3]]);
+    }
+
+    template<>
+    Vector4f TypedImageSampler<TexelFormat::RGBA16F>::fetch(int level, int x, int y)
+    {
+        auto t = Image->Texel<uint16_t>(level, x, y);
+        return Vector4f(HalfToFloat(t[0]), HalfToFloat(t[1]), HalfToFloat(t[2]), HalfToFloat(t[3]));
+    }
+
+    template<>
+    Vector4f TypedImageSampler<TexelFormat::RGBA32F>::fetch(int level, int x, int y)
+    {
+        return Map<const Vector4f>(Image->Texel<float>(level, x, y));
+    }
+
+    // texels are 4 wide, so the filter weights apply to a whole texel at once
+    template<TexelFormat F>
+    Vector4f TypedImageSampler<F>::sampleLevel(int level, float u, float v)
+    {
+        int width = Image->LevelWidth(level);
+        int height = Image->LevelHeight(level);
+        if(Interpolation == Interpolation::NEAREST)
+        {   
+            int x = (int)(u * (width - 1));
+            int y = (int)(v * (height - 1));
+            return fetch(level, x, y);
+        }
+        else if(Interpolation == Interpolation::BILINEAR)
+        {
+            int p = (int)(u * (width - 1));
+            int q = (int)(v * (height - 1));
+            float dx = (u * (width - 1)) - p;
+            float dy = (v * (height - 1)) - q;
+            Vector4f p00 = fetch(level, p,q);
+            Vector4f p01 = fetch(level, p, q + 1);
+            Vector4f p10 = fetch(level, p + 1, q);
+            Vector4f p11 = fetch(level, p + 1, q + 1);
+            return p00 * (1 - dx) * (1 - dy) + p10 * (dx) * (1 - dy) + p01 * (1 - dx) * dy + p11 * dx * dy;
+        }
+        return Vector4f::Zero();
     }
 
-    Vector3f ImageSampler::Sample(SamplerData& data)
+    template<TexelFormat F>
+    Vector3f TypedImageSampler<F>::Sample(SamplerData& data)
     {
         float u = data.u;
         float v = data.v;
         u = u - std::floor(u);
         v = v - std::floor(v);
-        if(Interpolation == Interpolation::NEAREST)
-        {   
-            int x = (int)(u * (Image->Width - 1));
-            int y = (int)(v * (Image->Height - 1));
-            return Image->Fetch(x, y) / Normalizer;
+        // the longer pixel footprint axis in texels picks the level
+        float fx = Vector2f(data.dudx * Image->Width, data.dvdx * Image->Height).norm();
+        float fy = Vector2f(data.dudy * Image->Width, data.dvdy * Image->Height).norm();
+        float footprint = std::max(fx, fy);
+        Vector4f c;
+        if(!(footprint > 1) || Image->Levels() == 1)
+        {
+            c = sampleLevel(0, u, v);
         }
-        else if(Interpolation == Interpolation::BILINEAR)
+        else
         {
-            int p = (int)(u * (Image->Width - 1));
-            int q = (int)(v * (Image->Height - 1));
-            float dx = (u * (Image->Width - 1)) - p;
-            float dy = (v * (Image->Height - 1)) - q;
-            auto p00 = Image->Fetch(p,q);
-            auto p01 = Image->Fetch(p, q + 1);
-            auto p10 = Image->Fetch(p + 1, q);
-            auto p11 = Image->Fetch(p + 1, q + 1);
-            auto ret = p00 * (1 - dx) * (1 - dy) + p10 * (dx) * (1 - dy) + p01 * (1 - dx) * dy + p11 * dx * dy;
-            return ret / Normalizer;
+            float level = std::min(std::log2(footprint), (float)(Image->Levels() - 1));
+            int l0 = (int)level;
+            if(Interpolation == Interpolation::NEAREST)
+            {
+                c = sampleLevel((int)(level + 0.5f), u, v);
+            }
+            else if(l0 + 1 >= Image->Levels())
+            {
+                c = sampleLevel(l0, u, v);
+            }
+            else
+            {
+                // trilinear, bilinear on the two nearest levels
+                float t = level - l0;
+                c = sampleLevel(l0, u, v) * (1 - t) + sampleLevel(l0 + 1, u, v) * t;
+            }
         }
-        return Vector3f::Zero();
+        return c.head<3>() / Normalizer;
     }
 
-    Vector3f ImageSampler::SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& n, float f)
+    template<TexelFormat F>
+    Vector3f TypedImageSampler<F>::SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& n, float f)
     {
         float u = data.u;
         float v = data.v;
@@ -140,16 +442,11 @@ namespace raytracer{
         v = v - std::floor(v);
         int x = (int)(u * (Image->Width - 1));
         int y = (int)(v * (Image->Height - 1));
-        float dxr = (Image->Fetch(x + 1, y).x() - Image->Fetch(x, y).x());
-        float dxg = (Image->Fetch(x + 1, y).y() - Image->Fetch(x, y).y());
-        float dxb = (Image->Fetch(x + 1, y).z() - Image->Fetch(x, y).z());
-
-        float dyr = (Image->Fetch(x, y + 1).x() - Image->Fetch(x, y).x());
-        float dyg = (Image->Fetch(x, y + 1).y() - Image->Fetch(x, y).y());
-        float dyb = (Image->Fetch(x, y + 1).z() - Image->Fetch(x, y).z());
-
-        float dx = (dxr + dxg + dxb) / 3;
-        float dy = (dyr + dyg + dyb) / 3;
+        Vector4f c = fetch(0, x, y);
+        Vector4f cx = fetch(0, x + 1, y) - c;
+        Vector4f cy = fetch(0, x, y + 1) - c;
+        float dx = (cx.x() + cx.y() + cx.z()) / 3;
+        float dy = (cy.x() + cy.y() + cy.z()) / 3;
         return (n - f * (t * dx + b * dy)).normalized();
     }
 
@@ -184,87 +481,83 @@ namespace raytracer{
         }
     }
 
-    Vector3f PerlinSampler::Sample(SamplerData& data)
+    template<bool Gradient>
+    float PerlinSampler::noise(const Vector3f& p, Vector3f& gradient)
     {
-        auto p = data.point * NoiseScale;
-        int x0 = (int)std::floor(p.x()) & (_tableSize - 1);
-        int y0 = (int)std::floor(p.y()) & (_tableSize - 1);
-        int z0 = (int)std::floor(p.z()) & (_tableSize - 1);
-        int x1 = (x0 + 1);
-        int y1 = (y0 + 1);
-        int z1 = (z0 + 1);
-
-        auto g000 = _grad[hash(x0, y0, z0)];
-        auto g001 = _grad[hash(x0, y0, z1)];
-        auto g010 = _grad[hash(x0, y1, z0)];
-        auto g011 = _grad[hash(x0, y1, z1)];
-        auto g100 = _grad[hash(x1, y0, z0)];
-        auto g101 = _grad[hash(x1, y0, z1)];
-        auto g110 = _grad[hash(x1, y1, z0)];
-        auto g111 = _grad[hash(x1, y1, z1)];
-
-        float dx = p.x() - std::floor(p.x());
-        float dy = p.y() - std::floor(p.y());
-        float dz = p.z() - std::floor(p.z());
-
-        float u = f(dx);
-        float v = f(dy);
-        float w = f(dz);
-
-        auto v000 = Vector3f(dx, dy, dz);
-        auto v001 = Vector3f(dx, dy, dz - 1);
-        auto v010 = Vector3f(dx, dy - 1, dz);
-        auto v011 = Vector3f(dx, dy - 1, dz - 1);
-        auto v100 = Vector3f(dx - 1, dy, dz);
-        auto v101 = Vector3f(dx - 1, dy, dz - 1);
-        auto v110 = Vector3f(dx - 1, dy - 1, dz);
-        auto v111 = Vector3f(dx - 1, dy - 1, dz - 1);
-
-        float d000 = g000.dot(v000);
-        float d001 = g001.dot(v001);
-        float d010 = g010.dot(v010);
-        float d011 = g011.dot(v011);
-        float d100 = g100.dot(v100);
-        float d101 = g101.dot(v101);
-        float d110 = g110.dot(v110);
-        float d111 = g111.dot(v111);
+        Vector3f floor = p.array().floor();
+        Vector3f d = p - floor;
+        int x0 = (int)floor.x() & (_tableSize - 1);
+        int y0 = (int)floor.y() & (_tableSize - 1);
+        int z0 = (int)floor.z() & (_tableSize - 1);
+        Vector3f s(f(d.x()), f(d.y()), f(d.z()));
 
+        // corner c is at offset (c >> 2, c >> 1 & 1, c & 1) from the cell's origin
+        float gx[8], gy[8], gz[8];
+        for(int c = 0; c < 8; c++)
+        {
+            auto& g = _grad[hash(x0 + (c >> 2), y0 + (c >> 1 & 1), z0 + (c & 1))];
+            gx[c] = g.x();
+            gy[c] = g.y();
+            gz[c] = g.z();
+        }
+        // trilinear weights of the corners and their projections onto the gradients
+        float wx[8], wy[8], wz[8], dot[8];
         float sum = 0;
-        float sx1 = lerp(d000, d100, u);
-        float sx2 = lerp(d010, d110, u);
-        float sy1 = lerp(sx1, sx2, v);
-        sx1 = lerp(d001, d101, u);
-        sx2 = lerp(d011, d111, u);
-        float sy2 = lerp (sx1, sx2, v);
-        sum = lerp(sy1, sy2, w);
+        for(int c = 0; c < 8; c++)
+        {
+            float ox = c >> 2, oy = c >> 1 & 1, oz = c & 1;
+            wx[c] = ox * s.x() + (1 - ox) * (1 - s.x());
+            wy[c] = oy * s.y() + (1 - oy) * (1 - s.y());
+            wz[c] = oz * s.z() + (1 - oz) * (1 - s.z());
+            dot[c] = gx[c] * (d.x() - ox) + gy[c] * (d.y() - oy) + gz[c] * (d.z() - oz);
+            sum += wx[c] * wy[c] * wz[c] * dot[c];
+        }
+        if(Gradient)
+        {
+            // the weights' slopes keep the sign of their corner's side
+            Vector3f ds(df(d.x()), df(d.y()), df(d.z()));
+            float dx = 0, dy = 0, dz = 0;
+            for(int c = 0; c < 8; c++)
+            {
+                float sx = (c >> 2) ? ds.x() : -ds.x();
+                float sy = (c >> 1 & 1) ? ds.y() : -ds.y();
+                float sz = (c & 1) ? ds.z() : -ds.z();
+                float w = wx[c] * wy[c] * wz[c];
+                dx += w * gx[c] + sx * wy[c] * wz[c] * dot[c];
+                dy += w * gy[c] + wx[c] * sy * wz[c] * dot[c];
+                dz += w * gz[c] + wx[c] * wy[c] * sz * dot[c];
+            }
+            gradient = Vector3f(dx, dy, dz);
+        }
 
         if(Conversion == NoiseConversion::LINEAR)
         {
-            sum = (sum + 1) / 2;
+            if(Gradient)
+                gradient /= 2;
+            return (sum + 1) / 2;
         }
         else if(Conversion == NoiseConversion::ABSVAL)
         {
-            sum = std::fabs(sum);
+            if(Gradient && sum < 0)
+                gradient = -gradient;
+            return std::fabs(sum);
         }
-        return Vector3f(sum, sum, sum);
+        return sum;
+    }
+
+    Vector3f PerlinSampler::Sample(SamplerData& data)
+    {
+        Vector3f gradient;
+        float value = noise<false>(data.point * NoiseScale, gradient);
+        return Vector3f(value, value, value);
     }
 
-    Vector3f PerlinSampler::SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& np, float f)
+    Vector3f PerlinSampler::SampleBump(SamplerData& data, Vector3f& /*t*/, Vector3f& /*b*/, Vector3f& /*np*/, float f)
     {
         auto n = data.normal;
-        float eps = 0.001f;
-        float c = Sample(data).x();
-        data.point.x() += eps;
-        float dx = (Sample(data).x() - c) / eps;
-        data.point.x() -= eps;
-        data.point.y() += eps;
-        float dy = (Sample(data).y() - c) / eps;
-        data.point.y() -= eps;
-        data.point.z() += eps;
-        float dz = (Sample(data).z() - c) / eps;
-        data.point.z() -= eps;
-    
-        auto grad = Vector3f(dx, dy, dz);
+        Vector3f grad;
+        noise<true>(data.point * NoiseScale, grad);
+        grad *= NoiseScale;
         auto gp = grad.dot(n) * n;
         auto go = grad - gp;
         return n - f * go; 
@@ -291,48 +584,297 @@ namespace raytracer{
         Size = node.child("Size").text().as_float(1);
     }
 
+    // pcg3d, three rounds of integer mixing that give each cell its own point
+    static inline void HashCell(uint32_t& x, uint32_t& y, uint32_t& z)
+    {
+        x = x * 1664525u + 1013904223u;
+        y = y * 1664525u + 1013904223u;
+        z = z * 1664525u + 1013904223u;
+        x += y * z;
+        y += z * x;
+        z += x * y;
+        x ^= x >> 16;
+        y ^= y >> 16;
+        z ^= z >> 16;
+        x += y * z;
+        y += z * x;
+        z += x * y;
+    }
+
+    template<bool Gradient>
+    float VoronoiSampler::distance(const Vector3f& p, Vector3f& gradient)
+    {
+        Vector3f floor = p.array().floor();
+        int cx = (int)floor.x();
+        int cy = (int)floor.y();
+        int cz = (int)floor.z();
+        // cell c is at offset (c / 9, c / 3 % 3, c % 3) - 1 from p's cell
+        float dx[27], dy[27], dz[27], d2[27];
+        for(int c = 0; c < 27; c++)
+        {
+            int ox = c / 9 - 1, oy = c / 3 % 3 - 1, oz = c % 3 - 1;
+            uint32_t x = cx + ox, y = cy + oy, z = cz + oz;
+            HashCell(x, y, z);
+            // top 24 bits as [0, 1) within the cell
+            dx[c] = floor.x() + ox + (x >> 8) * (1.0f / (1 << 24)) - p.x();
+            dy[c] = floor.y() + oy + (y >> 8) * (1.0f / (1 << 24)) - p.y();
+            dz[c] = floor.z() + oz + (z >> 8) * (1.0f / (1 << 24)) - p.z();
+            d2[c] = dx[c] * dx[c] + dy[c] * dy[c] + dz[c] * dz[c];
+        }
+        int nearest = 0;
+        for(int c = 1; c < 27; c++)
+            nearest = d2[c] < d2[nearest] ? c : nearest;
+        float d = std::sqrt(d2[nearest]);
+        if(Gradient)
+        {
+            // moving p away from the nearest point grows the distance
+            gradient = Vector3f(-dx[nearest], -dy[nearest], -dz[nearest]) / std::max(d, 1e-12f);
+        }
+        return d;
+    }
+
     Vector3f VoronoiSampler::Sample(SamplerData& data)
     {
-        auto p = data.point * Size;
-        float cx = std::floor(p.x());   
-        float cy = std::floor(p.y());
-        float cz = std::floor(p.z());
-        float min = 10;
-        for(int i = -1; i <= 1; i++)
+        Vector3f gradient;
+        float d = distance<false>(data.point * Size, gradient);
+        return Vector3f(d, d, d);
+    }
+
+    Vector3f VoronoiSampler::SampleBump(SamplerData& data, Vector3f& /*t*/, Vector3f& /*b*/, Vector3f& /*np*/, float f)
+    {
+        auto n = data.normal;
+        Vector3f grad;
+        distance<true>(data.point * Size, grad);
+        grad *= Size;
+        auto gp = grad.dot(n) * n;
+        auto go = grad - gp;
+        return n - f * go; 
+    }
+
+    static const char BakeMagic[8] = {'R', 'T', 'B', 'A', 'K', 'E', '1', 0};
+
+    struct BakeHeader
+    {
+        char Magic[8];
+        uint64_t Key;
+        uint32_t BrickPoints;
+        uint32_t Reserved;
+    };
+
+    std::string BakedSampler::_directory;
+
+    // hash of the texture's type, settings and sampler version, the id and where
+    // it's used don't change the bake
+    static uint64_t BakeKey(pugi::xml_node node, int version)
+    {
+        std::ostringstream text;
+        text << node.attribute("type").as_string() << " v" << version;
+        for(auto& child: node.children())
         {
-            for(int j = -1; j <= 1; j++)
+            if(std::strcmp(child.name(), "DecalMode") != 0)
+                child.print(text, "", pugi::format_raw);
+        }
+        return Fnv1a(text.str().data(), text.str().size());
+    }
+
+    BakedSampler::BakedSampler(Sampler* source, pugi::xml_node node)
+        : Resolution(node.child("BakeResolution").text().as_float(0)), _source(source)
+    {
+        if(_directory.empty())
+            return;
+        uint64_t key = BakeKey(node, source->Version());
+        char name[32];
+        std::snprintf(name, sizeof(name), "/%016llx.bake", (unsigned long long)key);
+        openFile(_directory + name, key);
+    }
+
+    void BakedSampler::openFile(const std::string& path, uint64_t key)
+    {
+        mkdir(_directory.c_str(), 0755);
+        int fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+        if(fd < 0)
+        {
+            fprintf(stderr, "can't open bake file %s: %s, baking for this run only\n", path.c_str(), std::strerror(errno));
+            return;
+        }
+        // other processes may be opening or appending to the same file
+        flock(fd, LOCK_EX);
+        BakeHeader header = {};
+        std::memcpy(header.Magic, BakeMagic, sizeof(BakeMagic));
+        header.Key = key;
+        header.BrickPoints = BrickPoints;
+        const size_t record = sizeof(uint64_t) + BrickPoints * BrickPoints * BrickPoints * 3 * sizeof(float);
+        struct stat st;
+        BakeHeader found;
+        bool ok = fstat(fd, &st) == 0;
+        if(ok && st.st_size == 0)
+            ok = write(fd, &header, sizeof(header)) == sizeof(header);
+        else
+            ok = ok && pread(fd, &found, sizeof(found), 0) == sizeof(found) && std::memcmp(&found, &header, sizeof(header)) == 0;
+        // a record cut short by a crash would misplace every later one, drop it
+        if(ok && st.st_size > 0 && (st.st_size - sizeof(BakeHeader)) % record != 0)
+            ok = ftruncate(fd, st.st_size - (st.st_size - sizeof(BakeHeader)) % record) == 0;
+        if(ok)
+            _baked.reset(new MappedFile(path.c_str()));
+        flock(fd, LOCK_UN);
+        if(!ok)
+        {
+            fprintf(stderr, "can't use bake file %s, baking for this run only\n", path.c_str());
+            close(fd);
+            return;
+        }
+        _file = fd;
+        // records are the brick key and its points
+        for(size_t offset = sizeof(BakeHeader); offset + record <= _baked->Size(); offset += record)
+        {
+            uint64_t brickKey;
+            std::memcpy(&brickKey, _baked->Data() + offset, sizeof(brickKey));
+            _bricks[brickKey] = {0, reinterpret_cast<const float*>(_baked->Data() + offset + sizeof(uint64_t))};
+        }
+    }
+
+    void BakedSampler::append(uint64_t key, const std::vector<float>& points)
+    {
+        std::vector<unsigned char> record(sizeof(key) + points.size() * sizeof(float));
+        std::memcpy(record.data(), &key, sizeof(key));
+        std::memcpy(record.data() + sizeof(key), points.data(), points.size() * sizeof(float));
+        flock(_file, LOCK_EX);
+        bool ok = write(_file, record.data(), record.size()) == (ssize_t)record.size();
+        flock(_file, LOCK_UN);
+        if(!ok)
+        {
+            fprintf(stderr, "can't write bake file, baking for this run only\n");
+            close(_file);
+            _file = -1;
+        }
+    }
+
+    struct BrickSlot
+    {
+        const BakedSampler* Owner = nullptr;
+        uint64_t Key;
+        uint64_t Offset;
+        const float* Data;
+    };
+
+    // a thread's last few bricks, most lookups take no lock
+    static thread_local BrickSlot brickSlots[8];
+
+    void BakedSampler::corners(const Vector3f& p, Vector3f* values, Vector3f& frac)
+    {
+        Vector3f g = p * Resolution;
+        Vector3f floor = g.array().floor();
+        frac = g - floor;
+        Vector3f b = (floor / BrickSize).array().floor();
+        int bx = b.x(), by = b.y(), bz = b.z();
+        int x = floor.x() - bx * BrickSize;
+        int y = floor.y() - by * BrickSize;
+        int z = floor.z() - bz * BrickSize;
+
+        // 21 bits of each brick coordinate
+        uint64_t key = (uint64_t)(bx & 0x1fffff) << 42 | (uint64_t)(by & 0x1fffff) << 21 | (uint64_t)(bz & 0x1fffff);
+        auto& slot = brickSlots[(key * 0x9E3779B97F4A7C15ull) >> 61];
+        if(slot.Owner != this || slot.Key != key)
+        {
+            auto found = brick(key, bx, by, bz);
+            slot.Owner = this;
+            slot.Key = key;
+            slot.Offset = found.Offset;
+            slot.Data = found.Data;
+        }
+        const size_t bytes = BrickPoints * BrickPoints * BrickPoints * 3 * sizeof(float);
+        auto data = slot.Data != nullptr ? slot.Data
+            : reinterpret_cast<const float*>(TextureCache::Shared().Tile(slot.Offset, bytes));
+        for(int c = 0; c < 8; c++)
+        {
+            auto v = &data[(((z + (c >> 2)) * BrickPoints + y + (c >> 1 & 1)) * BrickPoints + x + (c & 1)) * 3];
+            values[c] = Vector3f(v[0], v[1], v[2]);
+        }
+    }
+
+    BakedSampler::Brick BakedSampler::brick(uint64_t key, int bx, int by, int bz)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            auto found = _bricks.find(key);
+            if(found != _bricks.end())
+                return found->second;
+        }
+        // bake outside the lock, two threads missing the same brick both bake it
+        std::vector<float> points(BrickPoints * BrickPoints * BrickPoints * 3);
+        SamplerData data;
+        data.u = data.v = 0;
+        data.normal = Vector3f::Zero();
+        for(int z = 0, i = 0; z < BrickPoints; z++)
+        {
+            for(int y = 0; y < BrickPoints; y++)
             {
-                for(int k = -1; k <= 1; k++)
+                for(int x = 0; x < BrickPoints; x++, i += 3)
                 {
-                    Vector3f cell = Vector3f(cx + i, cy + j, cz + k);
-                    Vector3f cellPosition = cell + random3to3(cell);
-                    Vector3f toCell = cellPosition - p;
-                    float distToCell = toCell.norm();
-                    if(distToCell < min){
-                        min = distToCell;
-                    }                    
+                    data.point = Vector3f(bx * BrickSize + x, by * BrickSize + y, bz * BrickSize + z) / Resolution;
+                    Vector3f c = _source->Sample(data);
+                    points[i] = c.x();
+                    points[i + 1] = c.y();
+                    points[i + 2] = c.z();
                 }
             }
         }
-        return Vector3f(min, min, min);
+        std::lock_guard<std::mutex> lock(_lock);
+        auto found = _bricks.find(key);
+        if(found != _bricks.end())
+            return found->second;
+        if(_file >= 0)
+            append(key, points);
+        Brick brick;
+        if(TextureCache::Shared().Enabled())
+        {
+            brick.Offset = TextureCache::Shared().Store(reinterpret_cast<unsigned char*>(points.data()),
+                points.size() * sizeof(float));
+            brick.Data = nullptr;
+        }
+        else
+        {
+            _store.push_back(std::move(points));
+            brick.Offset = 0;
+            brick.Data = _store.back().data();
+        }
+        _bricks[key] = brick;
+        return brick;
     }
 
-    Vector3f VoronoiSampler::SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& np, float f)
+    Vector3f BakedSampler::Sample(SamplerData& data)
+    {
+        Vector3f values[8];
+        Vector3f d;
+        corners(data.point, values, d);
+        Vector3f c = Vector3f::Zero();
+        for(int i = 0; i < 8; i++)
+        {
+            float w = ((i & 1) ? d.x() : 1 - d.x()) * ((i >> 1 & 1) ? d.y() : 1 - d.y()) * ((i >> 2) ? d.z() : 1 - d.z());
+            c += w * values[i];
+        }
+        return c;
+    }
+
+    Vector3f BakedSampler::SampleBump(SamplerData& data, Vector3f& /*t*/, Vector3f& /*b*/, Vector3f& /*np*/, float f)
     {
         auto n = data.normal;
-        float eps = 0.001f;
-        float c = Sample(data).x();
-        data.point.x() += eps;
-        float dx = (Sample(data).x() - c) / eps;
-        data.point.x() -= eps;
-        data.point.y() += eps;
-        float dy = (Sample(data).y() - c) / eps;
-        data.point.y() -= eps;
-        data.point.z() += eps;
-        float dz = (Sample(data).z() - c) / eps;
-        data.point.z() -= eps;
-    
-        auto grad = Vector3f(dx, dy, dz);
+        Vector3f values[8];
+        Vector3f d;
+        corners(data.point, values, d);
+        // gradient of the trilinear blend of the first channel
+        Vector3f grad = Vector3f::Zero();
+        for(int i = 0; i < 8; i++)
+        {
+            float wx = (i & 1) ? d.x() : 1 - d.x();
+            float wy = (i >> 1 & 1) ? d.y() : 1 - d.y();
+            float wz = (i >> 2) ? d.z() : 1 - d.z();
+            float sx = (i & 1) ? 1 : -1;
+            float sy = (i >> 1 & 1) ? 1 : -1;
+            float sz = (i >> 2) ? 1 : -1;
+            grad += values[i].x() * Vector3f(sx * wy * wz, wx * sy * wz, wx * wy * sz);
+        }
+        grad *= Resolution;
         auto gp = grad.dot(n) * n;
         auto go = grad - gp;
         return n - f * go; 
@@ -355,7 +897,13 @@ namespace raytracer{
         }
         else if(_type.compare("image") == 0)
         {
-            Sampler = new ImageSampler(node);
+            Sampler = ImageSampler::Create(node);
+        }
+        // procedurals can be baked to a grid of that many points per unit
+        float bake = node.child("BakeResolution").text().as_float(0);
+        if(bake > 0 && _type.compare("image") != 0)
+        {
+            Sampler = new BakedSampler(Sampler, node);
         }
     }
 
@@ -420,8 +968,8 @@ namespace raytracer{
     }
 
 
-    void WriteEXR(std::vector<Vector3f> pixels, const int width, const int height,
-                   const char *filename)
+    void WriteEXR(const std::vector<Vector3f>& pixels, const int width, const int height,
+                   const char *filename, const std::string& compression)
     {
         EXRHeader header;
         EXRImage image;
@@ -468,6 +1016,13 @@ namespace raytracer{
             // pixel type of output image to be stored in .EXR
                 header.requested_pixel_types[i] = TINYEXR_PIXELTYPE_HALF; 
         }
+        // blocks are compressed on all cores by tinyexr
+        if(compression == "zip")
+            header.compression_type = TINYEXR_COMPRESSIONTYPE_ZIP;
+        else if(compression == "piz")
+            header.compression_type = TINYEXR_COMPRESSIONTYPE_PIZ;
+        else
+            header.compression_type = TINYEXR_COMPRESSIONTYPE_NONE;
 
         const char* err;
         int ret = SaveEXRImageToFile(&image, &header, filename, &err);
@@ -481,4 +1036,151 @@ namespace raytracer{
         free(header.pixel_types);
         free(header.requested_pixel_types);
         }
+
+    static void PutU32(std::vector<unsigned char>& out, unsigned int v)
+    {
+        out.push_back(v >> 24);
+        out.push_back(v >> 16);
+        out.push_back(v >> 8);
+        out.push_back(v);
+    }
+
+    static void PutChunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size)
+    {
+        PutU32(out, size);
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        PutU32(out, tinyexr::miniz::mz_crc32(MZ_CRC32_INIT, &out[start], size + 4));
+    }
+
+    static tinyexr::miniz::mz_bool AppendDeflated(const void* buf, int len, void* user)
+    {
+        auto out = (std::vector<unsigned char>*)user;
+        out->insert(out->end(), (const unsigned char*)buf, (const unsigned char*)buf + len);
+        return 1;
+    }
+
+    static unsigned int Adler32Combine(unsigned int a1, unsigned int a2, size_t len2)
+    {
+        const unsigned int base = 65521;
+        unsigned int rem = len2 % base;
+        unsigned int sum1 = a1 & 0xffff;
+        unsigned int sum2 = (unsigned int)(((unsigned long long)rem * sum1) % base);
+        sum1 += (a2 & 0xffff) + base - 1;
+        sum2 += (a1 >> 16) + (a2 >> 16) + base - rem;
+        if(sum1 >= base) sum1 -= base;
+        if(sum1 >= base) sum1 -= base;
+        if(sum2 >= 2 * base) sum2 -= 2 * base;
+        if(sum2 >= base) sum2 -= base;
+        return sum1 | (sum2 << 16);
+    }
+
+    static unsigned char Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if(pa <= pb && pa <= pc) return a;
+        if(pb <= pc) return b;
+        return c;
+    }
+
+    // picks the filter with the smallest sum of signed residuals, like lodepng's default
+    static void FilterRow(const unsigned char* row, const unsigned char* prev, int bytes, unsigned char* out)
+    {
+        std::vector<unsigned char> trial(bytes);
+        long best = -1;
+        for(int f = 0; f < 5; f++)
+        {
+            long sum = 0;
+            for(int i = 0; i < bytes; i++)
+            {
+                int a = i >= 3 ? row[i - 3] : 0;
+                int b = prev ? prev[i] : 0;
+                int c = prev && i >= 3 ? prev[i - 3] : 0;
+                unsigned char v;
+                if(f == 0) v = row[i];
+                else if(f == 1) v = row[i] - a;
+                else if(f == 2) v = row[i] - b;
+                else if(f == 3) v = row[i] - ((a + b) >> 1);
+                else v = row[i] - Paeth(a, b, c);
+                trial[i] = v;
+                sum += v < 128 ? v : 256 - v;
+            }
+            if(best < 0 || sum < best)
+            {
+                best = sum;
+                out[0] = f;
+                std::copy(trial.begin(), trial.end(), out + 1);
+            }
+        }
+    }
+
+    void WritePNG(const std::vector<unsigned char>& rgba, const int width, const int height,
+                   const std::string& filename)
+    {
+        namespace mz = tinyexr::miniz;
+        // alpha is always opaque, store rgb
+        int bytes = width * 3;
+        std::vector<unsigned char> rgb(bytes * height);
+        for(int i = 0; i < width * height; i++)
+        {
+            rgb[3 * i] = rgba[4 * i];
+            rgb[3 * i + 1] = rgba[4 * i + 1];
+            rgb[3 * i + 2] = rgba[4 * i + 2];
+        }
+
+        // every block of rows is filtered and deflated on its own, blocks before the
+        // last end with a sync flush so the raw streams concatenate into one
+        int blocks = std::max(1, std::min((int)std::thread::hardware_concurrency(), height / 16));
+        std::vector<std::vector<unsigned char>> deflated(blocks);
+        std::vector<unsigned int> adler(blocks);
+        std::vector<size_t> sizes(blocks);
+        std::vector<std::future<void>> tasks;
+        for(int b = 0; b < blocks; b++)
+        {
+            tasks.push_back(std::async(std::launch::async, [&, b]()
+            {
+                int y0 = (long)height * b / blocks;
+                int y1 = (long)height * (b + 1) / blocks;
+                std::vector<unsigned char> filtered((size_t)(y1 - y0) * (bytes + 1));
+                for(int y = y0; y < y1; y++)
+                {
+                    const unsigned char* prev = y > 0 ? &rgb[(size_t)(y - 1) * bytes] : nullptr;
+                    FilterRow(&rgb[(size_t)y * bytes], prev, bytes, &filtered[(size_t)(y - y0) * (bytes + 1)]);
+                }
+                sizes[b] = filtered.size();
+                adler[b] = mz::mz_adler32(MZ_ADLER32_INIT, filtered.data(), filtered.size());
+                std::unique_ptr<mz::tdefl_compressor> comp(new mz::tdefl_compressor);
+                mz::tdefl_init(comp.get(), AppendDeflated, &deflated[b], mz::TDEFL_DEFAULT_MAX_PROBES);
+                mz::tdefl_compress_buffer(comp.get(), filtered.data(), filtered.size(),
+                    b == blocks - 1 ? mz::TDEFL_FINISH : mz::TDEFL_SYNC_FLUSH);
+            }));
+        }
+        for(auto& t: tasks)
+            t.wait();
+
+        std::vector<unsigned char> zlib = {0x78, 0x01};
+        unsigned int checksum = adler[0];
+        for(int b = 0; b < blocks; b++)
+        {
+            zlib.insert(zlib.end(), deflated[b].begin(), deflated[b].end());
+            if(b > 0)
+                checksum = Adler32Combine(checksum, adler[b], sizes[b]);
+        }
+        PutU32(zlib, checksum);
+
+        std::vector<unsigned char> png = {137, 80, 78, 71, 13, 10, 26, 10};
+        std::vector<unsigned char> ihdr;
+        PutU32(ihdr, width);
+        PutU32(ihdr, height);
+        ihdr.insert(ihdr.end(), {8, 2, 0, 0, 0});
+        PutChunk(png, "IHDR", ihdr.data(), ihdr.size());
+        PutChunk(png, "IDAT", zlib.data(), zlib.size());
+        PutChunk(png, "IEND", nullptr, 0);
+        std::ofstream file(filename, std::ios::binary);
+        file.write((const char*)png.data(), png.size());
+    }
 }
\ No newline at end of file
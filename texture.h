@@ -8,20 +8,36 @@
 #include "Eigen/Dense"
 #include <random>
 #include <algorithm>
+#include <mutex>
+#include <deque>
+#include <unordered_map>
 #include "vecfrom.h"
+#include "texturecache.h"
+#include "half.h"
+#include "mappedfile.h"
+#include <memory>
+#include <cstdint>
 
 using namespace Eigen;
 
 namespace raytracer
 {
 
-    enum ImageMode{
-        RGB,
-        RGBA,
-        GRAYSCALE,
-        HDR
+    // how an image's texels are stored, every image is converted to one of
+    // these when it loads
+    enum class TexelFormat
+    {
+        RGBA8,
+        RGBA16F,
+        RGBA32F
     };
 
+    // channel type of each format, halves are kept as their bits
+    template<TexelFormat F> struct TexelTraits;
+    template<> struct TexelTraits<TexelFormat::RGBA8> { typedef uint8_t Channel; };
+    template<> struct TexelTraits<TexelFormat::RGBA16F> { typedef uint16_t Channel; };
+    template<> struct TexelTraits<TexelFormat::RGBA32F> { typedef float Channel; };
+
     enum TextureType{
         IMAGE,
         PERLIN
@@ -48,25 +64,74 @@ namespace raytracer
         float u, v;
         Vector3f point;
         Vector3f normal;
+        // uv footprint of a pixel, zero samples the full resolution image
+        float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
     };
 
-    struct Hdr
-    {
-        float* Pixels;
-    }; 
-
+    // Texels are kept in TileSize x TileSize tiles, so a filter footprint touches
+    // one or a few tiles instead of rows far apart. With the texture cache enabled
+    // the tiles live there and only the level layout stays here.
+    // Constructing an image only looks at its node, the file is decoded by Load.
     class Image
     {
         public:
+            static const int TileSize = 32;
             Image(pugi::xml_node node);
-            std::vector<unsigned char> Pixels;
-            Vector3f Fetch(int x, int y);
+            // decodes the file once, safe to call from several threads, a file that
+            // can't be read is fatal; sizes and texels are valid after it returns
+            void Load();
+            // any format, 8 bit channels come back as 0-255
+            Vector3f Fetch(int x, int y) { return Fetch(0, x, y); }
+            Vector3f Fetch(int level, int x, int y);
             unsigned Width = 0;
             unsigned Height = 0;
-            ImageMode Mode;
-            int stride;
+            TexelFormat Format = TexelFormat::RGBA8;
+            // box filtered half size copies down to 1x1, built once, level 0 is the
+            // image; loads it first, must not be called from a pool worker
+            void BuildMips();
+            int Levels() const { return _levels.size(); }
+            unsigned LevelWidth(int level) const { return _levels[level].Width; }
+            unsigned LevelHeight(int level) const { return _levels[level].Height; }
+            // the 4 channels of texel (x, y), clamped to the level, T must match Format
+            template<typename T>
+            const T* Texel(int level, int x, int y)
+            {
+                auto& l = _levels[level];
+                x = std::min<int>(x, l.Width - 1);
+                y = std::min<int>(y, l.Height - 1);
+                const unsigned char* tile = tileData(l.First + ((y / TileSize) * l.TilesX + x / TileSize) * tileBytes());
+                return reinterpret_cast<const T*>(tile + ((y % TileSize) * TileSize + x % TileSize) * _texelSize);
+            }
         private:
-            Hdr* _hdr;
+            struct Level
+            {
+                unsigned Width, Height;
+                unsigned TilesX;
+                // byte offset of the first tile in _tiles or in the texture cache
+                uint64_t First;
+            };
+            void decode();
+            // lays out a level's tiles in _tiles, or reserves room for them in the cache
+            Level newLevel(unsigned width, unsigned height);
+            // tiles the TileSize rows of strip s of a level, row(y, out) writes row y
+            // in Format; strips are independent, so they may be filled in parallel
+            template<typename R>
+            void storeStrip(const Level& level, unsigned strip, R row);
+            void readRow(int level, unsigned y, unsigned char* out);
+            size_t tileBytes() const { return TileSize * TileSize * _texelSize; }
+            const unsigned char* tileData(uint64_t offset)
+            {
+                return _cached ? TextureCache::Shared().Tile(offset, tileBytes()) : &_tiles[offset];
+            }
+
+            std::vector<Level> _levels;
+            std::vector<unsigned char> _tiles;
+            int _texelSize;
+            bool _cached;
+            std::string _path;
+            std::string _extension;
+            std::once_flag _loaded;
+            std::once_flag _mipsBuilt;
     };
 
     class Sampler
@@ -77,19 +142,40 @@ namespace raytracer
             {
                 return Vector3f::Zero();
             }
+            // raised whenever the sampler's output changes, it is part of the
+            // bake key so bricks baked by older code aren't reused
+            virtual int Version() const { return 1; }
     };
 
     class ImageSampler : public Sampler
     {
         public:
-            ImageSampler(pugi::xml_node node);
+            // the sampler specialized for the format of the image node refers to
+            static ImageSampler* Create(pugi::xml_node node);
             Image* Image;
             Interpolation Interpolation = Interpolation::NEAREST;
             float Normalizer;
+        protected:
+            ImageSampler(pugi::xml_node node);
+            // 8 bit channel values, as they are or sRGB decoded when degamma is set
+            float _decode[256];
+    };
+
+    template<TexelFormat F>
+    class TypedImageSampler : public ImageSampler
+    {
+        public:
+            TypedImageSampler(pugi::xml_node node) : ImageSampler(node) {}
             virtual Vector3f Sample(SamplerData& data) override;
             virtual Vector3f SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& n, float f) override;
+        private:
+            Vector4f fetch(int level, int x, int y);
+            Vector4f sampleLevel(int level, float u, float v);
     };
 
+    // Noise kernels evaluate all lattice corners (Perlin) or neighbouring cells
+    // (Voronoi) of a point as arrays in plain arithmetic, so the loops vectorize,
+    // and give the gradient along with the value for bump mapping.
     class PerlinSampler : public Sampler
     {
         public:
@@ -102,6 +188,9 @@ namespace raytracer
             int _tableSize = 16;
             std::vector<int> _ptable;
             std::vector<Vector3f> _grad;
+            // converted noise at p, its gradient in p's space when Gradient is set
+            template<bool Gradient>
+            float noise(const Vector3f& p, Vector3f& gradient);
             inline int hash(int x, int y, int z)
             {
                 return _ptable[_ptable[_ptable[x] + y] + z];   
@@ -110,11 +199,9 @@ namespace raytracer
             {
                 return t * t * t * (t * (t * 6 - 15) + 10);
             }
-            inline float lerp(float a, float b, float t)
+            inline float df(float t)
             {
-                t = t > 1 ? 1 : t;
-                t = t < 0 ? 0 : t;
-                return a + (b - a) * t;
+                return 30 * t * t * (t * (t - 2) + 1);
             }
     };    
 
@@ -137,21 +224,56 @@ namespace raytracer
             virtual Vector3f SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& n, float f) override;
             float Size;
         private:
-            float random3to1(Vector3f p, Vector3f d)
-            {
-                float x = std::sinf(p.dot(d)) * 23453.2342;                
-                return x - std::floor(x); 
-            }        
-            Vector3f random3to3(Vector3f p)
-            {
-                float x = random3to1(p, Vector3f(124.3, 232.4, 634.1));
-                float y = random3to1(p, Vector3f(742.5, 145.3, 314.6));
-                float z = random3to1(p, Vector3f(923.9, 236.5, 892.6));
-                return Vector3f(x, y, z);
-            }
+            // distance from p to the nearest cell point, its gradient when Gradient is set
+            template<bool Gradient>
+            float distance(const Vector3f& p, Vector3f& gradient);
     };
 
 
+    // Evaluates a procedural once on a grid of Resolution points per unit and
+    // interpolates that from then on. The grid is split into bricks that are baked
+    // the first time a lookup lands in them, so only the space around textured
+    // surfaces gets filled. With the texture cache enabled the bricks live there.
+    // With a bake directory set, bricks are also appended to a file named after
+    // the texture's settings, and later runs map that file and skip those bricks.
+    class BakedSampler : public Sampler
+    {
+        public:
+            static const int BrickSize = 8;
+            // node is the TextureMap, its BakeResolution and settings key the bake file
+            // along with the source's version
+            BakedSampler(Sampler* source, pugi::xml_node node);
+            // where bake files go, empty keeps bricks for this run only, the default
+            static void SetDirectory(const std::string& path) { _directory = path; }
+            virtual Vector3f Sample(SamplerData& data) override;
+            virtual Vector3f SampleBump(SamplerData& data, Vector3f& t, Vector3f& b, Vector3f& n, float f) override;
+            float Resolution;
+        private:
+            // a brick holds one more point than cells a side, so a lookup never
+            // leaves its brick
+            static const int BrickPoints = BrickSize + 1;
+            struct Brick
+            {
+                // offset in the texture cache, or the points themselves
+                uint64_t Offset;
+                const float* Data;
+            };
+            // rgb of the 8 grid points around p, x fastest, and p's place between them
+            void corners(const Vector3f& p, Vector3f* values, Vector3f& frac);
+            Brick brick(uint64_t key, int bx, int by, int bz);
+            void openFile(const std::string& path, uint64_t key);
+            void append(uint64_t key, const std::vector<float>& points);
+
+            static std::string _directory;
+            Sampler* _source;
+            std::mutex _lock;
+            std::unordered_map<uint64_t, Brick> _bricks;
+            std::deque<std::vector<float>> _store;
+            // bricks earlier runs baked, and the file this run appends to, -1 if none
+            std::unique_ptr<MappedFile> _baked;
+            int _file = -1;
+    };
+
     class Texture
     {
         public:
@@ -193,7 +315,10 @@ namespace raytracer
             float Factor;
     };
 
-    void WriteEXR(std::vector<Vector3f> pixels, const int width, const int height,
-                   const char *filename);
+    void WriteEXR(const std::vector<Vector3f>& pixels, const int width, const int height,
+                   const char *filename, const std::string& compression);
+    // rgba8 in, rgb8 png out, rows are filtered and deflated in parallel blocks
+    void WritePNG(const std::vector<unsigned char>& rgba, const int width, const int height,
+                   const std::string& filename);
 
 }
\ No newline at end of file
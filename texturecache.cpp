@@ -0,0 +1,122 @@
+#include "texturecache.h"
+#include <cstdlib>
+#include <unistd.h>
+
+namespace raytracer
+{
+    static const int MicroCacheBits = 3;
+
+    struct MicroEntry
+    {
+        uint64_t Offset = UINT64_MAX;
+        std::shared_ptr<const std::vector<unsigned char>> Data;
+    };
+
+    // a thread's own tiles, they stay usable even after the shared cache evicts them
+    static thread_local MicroEntry micro[1 << MicroCacheBits];
+
+    TextureCache::~TextureCache()
+    {
+        if(_file != nullptr)
+            std::fclose(_file);
+    }
+
+    TextureCache& TextureCache::Shared()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    uint64_t TextureCache::Store(const unsigned char* data, size_t bytes)
+    {
+        uint64_t offset = Reserve(bytes);
+        Write(offset, data, bytes);
+        return offset;
+    }
+
+    uint64_t TextureCache::Reserve(size_t bytes)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if(_file == nullptr)
+            _file = std::tmpfile();
+        if(_file == nullptr)
+        {
+            fprintf(stderr, "can't write texture cache file\n");
+            exit(1);
+        }
+        uint64_t offset = _size;
+        _size += bytes;
+        return offset;
+    }
+
+    void TextureCache::Write(uint64_t offset, const unsigned char* data, size_t bytes)
+    {
+        // written and read back with pwrite and pread, so several images can fill
+        // their reserved ranges at once
+        size_t done = 0;
+        while(done < bytes)
+        {
+            auto n = pwrite(fileno(_file), data + done, bytes - done, offset + done);
+            if(n <= 0)
+            {
+                fprintf(stderr, "can't write texture cache file\n");
+                exit(1);
+            }
+            done += n;
+        }
+    }
+
+    const unsigned char* TextureCache::Tile(uint64_t offset, size_t bytes)
+    {
+        auto& slot = micro[(offset * 0x9E3779B97F4A7C15ull) >> (64 - MicroCacheBits)];
+        if(slot.Offset != offset)
+        {
+            slot.Data = fetch(offset, bytes);
+            slot.Offset = offset;
+        }
+        return slot.Data->data();
+    }
+
+    TextureCache::TileData TextureCache::fetch(uint64_t offset, size_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            auto found = _index.find(offset);
+            if(found != _index.end())
+            {
+                _lru.splice(_lru.begin(), _lru, found->second);
+                return found->second->Data;
+            }
+        }
+        // read outside the lock, two threads missing the same tile both read it
+        auto data = std::make_shared<std::vector<unsigned char>>(bytes);
+        size_t done = 0;
+        while(done < bytes)
+        {
+            auto n = pread(fileno(_file), data->data() + done, bytes - done, offset + done);
+            if(n <= 0)
+            {
+                fprintf(stderr, "can't read texture cache file\n");
+                exit(1);
+            }
+            done += n;
+        }
+        std::lock_guard<std::mutex> lock(_lock);
+        auto found = _index.find(offset);
+        if(found != _index.end())
+        {
+            _lru.splice(_lru.begin(), _lru, found->second);
+            return found->second->Data;
+        }
+        _lru.push_front({offset, data});
+        _index[offset] = _lru.begin();
+        _resident += bytes;
+        while(_resident > _budget && _lru.size() > 1)
+        {
+            _resident -= _lru.back().Data->size();
+            _index.erase(_lru.back().Offset);
+            _lru.pop_back();
+        }
+        return data;
+    }
+}
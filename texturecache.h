@@ -0,0 +1,52 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace raytracer
+{
+    // Bounded store for image tiles. Once an image has built its tiles it hands
+    // them over, they go to a temporary backing file and are read back on demand,
+    // keeping at most the budget resident and evicting the least recently used.
+    // Each thread keeps its last few tiles to itself, so most lookups take no lock.
+    class TextureCache
+    {
+        public:
+            ~TextureCache();
+            static TextureCache& Shared();
+            // 0 keeps every tile in its image, the default
+            void SetBudget(size_t bytes) { _budget = bytes; }
+            bool Enabled() const { return _budget > 0; }
+            // appends bytes to the backing file and returns their offset, tiles are
+            // looked up by that offset from then on
+            uint64_t Store(const unsigned char* data, size_t bytes);
+            // room for bytes in the backing file, filled piecewise with Write, so
+            // a large level never has to be built in memory at once
+            uint64_t Reserve(size_t bytes);
+            void Write(uint64_t offset, const unsigned char* data, size_t bytes);
+            // the tile stored at offset, valid until this thread's next lookup
+            const unsigned char* Tile(uint64_t offset, size_t bytes);
+        private:
+            typedef std::shared_ptr<const std::vector<unsigned char>> TileData;
+            struct Entry
+            {
+                uint64_t Offset;
+                TileData Data;
+            };
+            TileData fetch(uint64_t offset, size_t bytes);
+
+            size_t _budget = 0;
+            size_t _resident = 0;
+            uint64_t _size = 0;
+            FILE* _file = nullptr;
+            std::mutex _lock;
+            // most recent first
+            std::list<Entry> _lru;
+            std::unordered_map<uint64_t, std::list<Entry>::iterator> _index;
+    };
+}
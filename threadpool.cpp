@@ -0,0 +1,72 @@
+#include "threadpool.h"
+#include <algorithm>
+
+namespace raytracer
+{
+    ThreadPool::ThreadPool(int threads)
+    {
+        threads = std::max(1, threads);
+        for(int i = 0; i < threads; i++)
+        {
+            _workers.emplace_back([this]()
+            {
+                while(true)
+                {
+                    std::packaged_task<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(_lock);
+                        _wake.wait(lock, [this]() { return _stop || !_queue.empty() || !_urgent.empty(); });
+                        auto& queue = _urgent.empty() ? _queue : _urgent;
+                        if(queue.empty())
+                            return;
+                        task = std::move(queue.front());
+                        queue.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stop = true;
+        }
+        _wake.notify_all();
+        for(auto& worker: _workers)
+            worker.join();
+    }
+
+    std::future<void> ThreadPool::Submit(std::function<void()> task, bool urgent)
+    {
+        std::packaged_task<void()> packaged(std::move(task));
+        auto future = packaged.get_future();
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            (urgent ? _urgent : _queue).push_back(std::move(packaged));
+        }
+        _wake.notify_one();
+        return future;
+    }
+
+    void ThreadPool::Run(int count, const std::function<void()>& task, bool urgent)
+    {
+        std::vector<std::future<void>> futures;
+        for(int i = 0; i < count; i++)
+            futures.push_back(Submit(task, urgent));
+        // every task refers to the caller's state, so all of them finish before
+        // an exception from one is passed on
+        for(auto& future: futures)
+            future.wait();
+        for(auto& future: futures)
+            future.get();
+    }
+
+    ThreadPool& ThreadPool::Shared()
+    {
+        static ThreadPool pool(std::thread::hardware_concurrency());
+        return pool;
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace raytracer
+{
+    // Fixed set of worker threads that live for the whole run. Tasks from every
+    // camera, tile and progressive pass go through the same queue, first in first out.
+    // Urgent tasks (output work of a finished image) have their own queue, which
+    // workers drain before taking the next regular task.
+    class ThreadPool
+    {
+        public:
+            ThreadPool(int threads);
+            ~ThreadPool();
+            std::future<void> Submit(std::function<void()> task, bool urgent = false);
+            // runs task on count workers and waits for all of them, then rethrows
+            // the first exception a task threw
+            void Run(int count, const std::function<void()>& task, bool urgent = false);
+            // calls f(begin, end) over [0, count) in blocks on up to Size() workers and waits,
+            // must not be called from a worker
+            template<typename F>
+            void For(size_t count, size_t block, F f, bool urgent = false)
+            {
+                std::atomic<size_t> next(0);
+                int tasks = std::min<size_t>(Size(), (count + block - 1) / block);
+                Run(tasks, [&]()
+                {
+                    while(true)
+                    {
+                        size_t begin = next.fetch_add(block);
+                        if(begin >= count)
+                            break;
+                        f(begin, std::min(begin + block, count));
+                    }
+                }, urgent);
+            }
+            int Size() const { return _workers.size(); }
+            // one thread per hardware thread
+            static ThreadPool& Shared();
+        private:
+            std::vector<std::thread> _workers;
+            std::deque<std::packaged_task<void()>> _queue;
+            std::deque<std::packaged_task<void()>> _urgent;
+            std::mutex _lock;
+            std::condition_variable _wake;
+            bool _stop = false;
+    };
+}
@@ -1,9 +1,18 @@
 #pragma once
 #include "Eigen/Dense"
 #include <algorithm>
+#include <atomic>
+#include "threadpool.h"
+#include "fastmath.h"
 
 namespace raytracer{
 
+    // Exact keeps libm pow/log, Fast uses the approximations in fastmath.h
+    enum class TonemapAccuracy
+    {
+        Exact,
+        Fast
+    };
 
     class ToneMapper
     {
@@ -12,8 +21,125 @@ namespace raytracer{
             {
 
             }
-            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data) = 0;
+            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data, TonemapAccuracy accuracy = TonemapAccuracy::Exact) = 0;
+        protected:
+            static constexpr int Lanes = 8;
+
+            // 8 bit encode curve stored as the smallest input reaching each level,
+            // plus the level at the start of 128 buckets per octave over [2^-16, 1]
+            // so a lookup is one table read and a compare per boundary in the bucket,
+            // at most two up to gamma 2.4 but more for steeper curves
+            struct EncodeTable
+            {
+                static constexpr uint32_t LowBucket = 111 << 7;
+                float Threshold[257];
+                unsigned char Start[16 * 128 + 1];
+
+                template<typename F>
+                void Build(F curve)
+                {
+                    uint32_t one;
+                    float fone = 1.0f;
+                    std::memcpy(&one, &fone, 4);
+                    Threshold[0] = 0;
+                    Threshold[256] = INFINITY;
+                    for(int k = 1; k < 256; k++)
+                    {
+                        // non-negative floats order like their bits
+                        uint32_t lo = 0;
+                        uint32_t hi = one + 1;
+                        while(lo < hi)
+                        {
+                            uint32_t mid = lo + (hi - lo) / 2;
+                            float x;
+                            std::memcpy(&x, &mid, 4);
+                            if(curve(x) >= k)
+                                hi = mid;
+                            else
+                                lo = mid + 1;
+                        }
+                        if(lo > one)
+                            Threshold[k] = INFINITY;
+                        else
+                            std::memcpy(&Threshold[k], &lo, 4);
+                    }
+                    // bucket 0 also holds everything below 2^-16
+                    Start[0] = search(0);
+                    for(uint32_t b = 1; b <= 16 * 128; b++)
+                    {
+                        uint32_t bits = (b + LowBucket) << 16;
+                        float x;
+                        std::memcpy(&x, &bits, 4);
+                        Start[b] = search(x);
+                    }
+                }
+
+                // clamps to [0, 255], nan maps to 0
+                unsigned char operator()(float x) const
+                {
+                    float c = x > 1.52587890625e-05f ? x : 1.52587890625e-05f;
+                    c = c < 1.0f ? c : 1.0f;
+                    uint32_t bits;
+                    std::memcpy(&bits, &c, 4);
+                    int i = Start[(bits >> 16) - LowBucket];
+                    // Threshold[256] is infinite, so this stops at 255
+                    while(x >= Threshold[i + 1])
+                        i++;
+                    return i;
+                }
+
+                int search(float x) const
+                {
+                    int i = 0;
+                    for(int s = 128; s > 0; s >>= 1)
+                        i += x >= Threshold[i + s] ? s : 0;
+                    return i;
+                }
+            };
+
+            EncodeTable _encode;
 
+            // calls f(begin, end) over blocks of pixels on the shared pool, ahead of
+            // tiles still queued for other cameras
+            template<typename F>
+            static void ForBlocks(int size, F f)
+            {
+                ThreadPool::Shared().For(size, 16384, [&](size_t begin, size_t end)
+                {
+                    f((int)begin, (int)end);
+                }, true);
+            }
+
+            // runs kernel(r, g, b) on Lanes pixels at a time in SoA form and encodes the result
+            template<typename K>
+            void MapLanes(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data, K kernel)
+            {
+                ForBlocks(pixels.size(), [&](int begin, int end)
+                {
+                    alignas(32) float r[Lanes];
+                    alignas(32) float g[Lanes];
+                    alignas(32) float b[Lanes];
+                    for(int i = begin; i < end; i += Lanes)
+                    {
+                        int n = std::min(Lanes, end - i);
+                        for(int j = 0; j < Lanes; j++)
+                        {
+                            auto& p = pixels[i + std::min(j, n - 1)];
+                            r[j] = p.x();
+                            g[j] = p.y();
+                            b[j] = p.z();
+                        }
+                        kernel(r, g, b);
+                        for(int j = 0; j < n; j++)
+                        {
+                            data[(i + j)*4]     = _encode(r[j]);
+                            data[(i + j)*4 + 1] = _encode(g[j]);
+                            data[(i + j)*4 + 2] = _encode(b[j]);
+                            data[(i + j)*4 + 3] = 255;
+                        }
+                    }
+                });
+            }
     };
 
     class PhotographicToneMapper : public ToneMapper
@@ -27,22 +153,28 @@ namespace raytracer{
                 auto g = node.child("Gamma").text().as_string();
                 _sat = node.child("Saturation").text().as_float();
                 if(std::strcmp(g, "sRGB") == 0)
+                {
                     _srgb = true;
+                    _encode.Build([&](float x){ return (int)linear_to_srgb(x); });
+                }
                 else
-                 _gamma = node.child("Gamma").text().as_float();
-
+                {
+                    _gamma = node.child("Gamma").text().as_float();
+                    float inv = 1/_gamma;
+                    _encode.Build([&](float x){ return (int)floor(pow(x,  inv) * 255.0f); });
+                }
             }
         private:
             float _kv;
             float _burn;
             float _gamma;
             float _sat;
-            bool _srgb;
-            float luminance(Vector3f& rgb)
+            bool _srgb = false;
+            static float luminance(float r, float g, float b)
             {
-                return 0.212671 * rgb.x() + 0.71516 * rgb.y() + 0.072169 * rgb.z();
+                return 0.212671 * r + 0.71516 * g + 0.072169 * b;
             }
-            float linear_to_srgb(float linear) 
+            float linear_to_srgb(float linear)
             {
                 float srgb;
                 if (linear <= 0.0031308f) {
@@ -53,67 +185,99 @@ namespace raytracer{
                 return srgb * 255.f;
             }
         public:
-            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data) override
+            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data, TonemapAccuracy accuracy) override
             {
-                
-                std::vector<float> ls(pixels.size(), 0);
-                std::vector<float> lws(pixels.size(), 0);
-                for(int i = 0; i < pixels.size(); i++)
+                bool fast = accuracy == TonemapAccuracy::Fast;
+                int size = pixels.size();
+                std::vector<float> lws(size);
+                std::vector<double> logs((size + 16383) / 16384, 0);
+                // histogram of the top 12 bits of each luminance, which order like the floats
+                std::vector<std::atomic<int>> hist(4096);
+                ForBlocks(size, [&](int begin, int end)
                 {
-                    if(pixels[i].x() < 0 || pixels[i].y() < 0 || pixels[i].z() < 0)
-                        pixels[i] = Vector3f::Zero();
-                    lws[i] = luminance(pixels[i]);
-                }
-                float avglw = 0;
-                for(int i = 0; i < lws.size(); i++)
-                {
-                    if(lws[i] > 0)
-                        avglw += std::log(lws[i] + 1e-6);
-                }
-                avglw = std::exp(avglw / ls.size());
-                for(int i = 0; i < ls.size(); i++)
+                    double sum = 0;
+                    int local[4096] = {};
+                    for(int i = begin; i < end; i++)
+                    {
+                        if(pixels[i].x() < 0 || pixels[i].y() < 0 || pixels[i].z() < 0)
+                            pixels[i] = Vector3f::Zero();
+                        lws[i] = luminance(pixels[i].x(), pixels[i].y(), pixels[i].z());
+                        uint32_t bits;
+                        std::memcpy(&bits, &lws[i], 4);
+                        local[bits >> 20]++;
+                    }
+                    for(int b = 0; b < 4096; b++)
+                        if(local[b])
+                            hist[b] += local[b];
+                    if(fast)
+                    {
+                        for(int i = begin; i < end; i++)
+                            sum += lws[i] > 0 ? FastLog2(lws[i] + 1e-6f) : 0.0f;
+                        sum *= 0.693147181;
+                    }
+                    else
+                    {
+                        for(int i = begin; i < end; i++)
+                            if(lws[i] > 0)
+                                sum += std::log(lws[i] + 1e-6);
+                    }
+                    logs[begin / 16384] = sum;
+                });
+                double logsum = 0;
+                for(auto l: logs)
+                    logsum += l;
+                float avglw = std::exp(logsum / size);
+                float scale = _kv / avglw;
+                // burn percentile: find the histogram bin holding the rank,
+                // then select within that bin only
+                float ratio = (100 - _burn) / 100;
+                int rn = size * ratio - 1;
+                rn = std::clamp(rn, 0, size - 1);
+                uint32_t bin = 0;
+                while(rn >= hist[bin])
+                    rn -= hist[bin++];
+                std::vector<float> lss;
+                lss.reserve(hist[bin]);
+                for(auto lw: lws)
                 {
-                    ls[i] = (_kv / avglw) * lws[i];
+                    uint32_t bits;
+                    std::memcpy(&bits, &lw, 4);
+                    if((bits >> 20) == bin)
+                        lss.push_back(lw);
                 }
-                std::vector<float> lss(ls);
-                std::sort(lss.begin(), lss.end());
-                float ratio = (100 - _burn) / 100;
-                int rn = ls.size() * ratio - 1;
-                float lwhite = lss[rn] * lss[rn];
-                for(int i = 0; i < ls.size(); i++)
+                std::nth_element(lss.begin(), lss.begin() + rn, lss.end());
+                float lwhite = lss[rn] * scale;
+                lwhite *= lwhite;
+                float sat = _sat;
+                MapLanes(pixels, data, [&](float* r, float* g, float* b)
                 {
-                    auto tmp = (ls[i] * (1.0f + (ls[i] / lwhite))) / (1.0f + ls[i]);
-                    ls[i] = tmp;
-                }      
-                float g = 1/_gamma;
-                for(int i = 0; i < pixels.size(); i++)
-                {                    
-                    auto temp = pixels[i];
-                    temp.x() = std::clamp(powf(temp.x() / lws[i], _sat) * ls[i], 0.0f, 1.0f);
-                    temp.y() = std::clamp(powf(temp.y() / lws[i], _sat) * ls[i], 0.0f, 1.0f);
-                    temp.z() = std::clamp(powf(temp.z() / lws[i], _sat) * ls[i], 0.0f, 1.0f);
-
-                    unsigned char rd;
-                    unsigned char gd;
-                    unsigned char bd; 
-                    if(!_srgb)
+                    alignas(32) float l[Lanes];
+                    alignas(32) float lw[Lanes];
+                    for(int j = 0; j < Lanes; j++)
                     {
-                        rd = (int)floor(pow(temp.x(),  g) * 255.0f);
-                        gd = (int)floor(pow(temp.y(),  g) * 255.0f);
-                        bd = (int)floor(pow(temp.z(),  g) * 255.0f);
+                        lw[j] = luminance(r[j], g[j], b[j]);
+                        float s = scale * lw[j];
+                        l[j] = (s * (1.0f + (s / lwhite))) / (1.0f + s);
+                        r[j] /= lw[j];
+                        g[j] /= lw[j];
+                        b[j] /= lw[j];
                     }
-                    else
+                    if(sat != 1)
                     {
-                        rd = (int)linear_to_srgb(temp.x());
-                        gd = (int)linear_to_srgb(temp.y());
-                        bd = (int)linear_to_srgb(temp.z());
+                        for(int j = 0; j < Lanes; j++)
+                        {
+                            r[j] = fast ? FastPow(r[j], sat) : powf(r[j], sat);
+                            g[j] = fast ? FastPow(g[j], sat) : powf(g[j], sat);
+                            b[j] = fast ? FastPow(b[j], sat) : powf(b[j], sat);
+                        }
                     }
-
-                    data[i*4]     = rd;
-                    data[i*4 + 1] = gd;
-                    data[i*4 + 2] = bd;
-                    data[i*4 + 3] = 255;
-                } 
+                    for(int j = 0; j < Lanes; j++)
+                    {
+                        r[j] *= l[j];
+                        g[j] *= l[j];
+                        b[j] *= l[j];
+                    }
+                });
             }
 
     };
@@ -127,14 +291,16 @@ namespace raytracer{
                 _exposureBias = options.x();
                 _w = options.y();
                 _gamma = node.child("Gamma").text().as_float();
+                float g = 1/_gamma;
+                _encode.Build([&](float x){ return (int)floor(pow(x,  g) * 255.0f); });
             }
         private:
-            
+
             float _exposureBias;
             float _w;
             float _gamma;
 
-            Array3f uncharted2_tonemap_partial(Array3f x)
+            static float uncharted2_tonemap_partial(float x)
             {
                 float A = 0.15f;
                 float B = 0.50f;
@@ -145,39 +311,20 @@ namespace raytracer{
                 return ((x*(A*x+C*B)+D*E)/(x*(A*x+B)+D*F))-E/F;
             }
 
-            Vector3f uncharted2_filmic(Vector3f v)
-            {
-                Array3f curr = uncharted2_tonemap_partial(v * _exposureBias);
-                Array3f W = Array3f(_w, _w, _w);
-                Array3f white_scale = Array3f(1.0f, 1.0f, 1.0f) / uncharted2_tonemap_partial(W);
-                return curr * white_scale;
-            }
-
         public:
-            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data) override
-            {                
-                for(int i = 0; i < pixels.size(); i++)
-                {
-                    pixels[i] = uncharted2_filmic(pixels[i]);                    
-                }
-                float g = 1/_gamma;
-                for(int i = 0; i < pixels.size(); i++)
+            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data, TonemapAccuracy /*accuracy*/) override
+            {
+                float white_scale = 1.0f / uncharted2_tonemap_partial(_w);
+                float bias = _exposureBias;
+                MapLanes(pixels, data, [&](float* r, float* g, float* b)
                 {
-                    auto temp = pixels[i];
-                    temp.x() = std::clamp(pixels[i].x(), 0.0f, 1.0f);
-                    temp.y() = std::clamp(pixels[i].y(), 0.0f, 1.0f);
-                    temp.z() = std::clamp(pixels[i].z(), 0.0f, 1.0f);
-
-                    unsigned char rd = (int)floor(pow(temp.x(),  g) * 255.0f);
-                    unsigned char gd = (int)floor(pow(temp.y(),  g) * 255.0f);
-                    unsigned char bd = (int)floor(pow(temp.z(),  g) * 255.0f);
-
-                    data[i*4]     = rd;
-                    data[i*4 + 1] = gd;
-                    data[i*4 + 2] = bd;
-                    data[i*4 + 3] = 255;
-                } 
-
+                    for(int j = 0; j < Lanes; j++)
+                    {
+                        r[j] = uncharted2_tonemap_partial(r[j] * bias) * white_scale;
+                        g[j] = uncharted2_tonemap_partial(g[j] * bias) * white_scale;
+                        b[j] = uncharted2_tonemap_partial(b[j] * bias) * white_scale;
+                    }
+                });
             }
     };
 
@@ -198,6 +345,8 @@ namespace raytracer{
                      1.60475f, -0.53108f, -0.07367f,
                     -0.10208f,  1.10813f, -0.00605f,
                     -0.00327f, -0.07276f,  1.07602f;
+                float g = 1/_gamma;
+                _encode.Build([&](float x){ return (int)floor(pow(x,  g) * 255.0f); });
             }
         private:
             float _exposureBias;
@@ -205,45 +354,48 @@ namespace raytracer{
             Matrix3f aces_input_matrix;
             Matrix3f aces_output_matrix;
 
-            Array3f rtt_and_odt_fit(Array3f v)
+            static float rtt_and_odt_fit(float v)
             {
-                Array3f a = v * (v + 0.0245786f) - 0.000090537f;
-                Array3f b = v * (0.983729f * v + 0.4329510f) + 0.238081f;
+                float a = v * (v + 0.0245786f) - 0.000090537f;
+                float b = v * (0.983729f * v + 0.4329510f) + 0.238081f;
                 return a / b;
             }
 
-            Vector3f aces_fitted(Vector3f v)
+            // out = m * (r, g, b) on each lane
+            static void transform(const Matrix3f& m, float* r, float* g, float* b)
             {
-                v = aces_input_matrix * v;
-                v = rtt_and_odt_fit(v);
-                return aces_output_matrix * v;
-            }
-        public:
-            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data) override
-            {                
-                for(int i = 0; i < pixels.size(); i++)
+                for(int j = 0; j < Lanes; j++)
                 {
-                    pixels[i] = aces_fitted(pixels[i] * _exposureBias);                    
+                    float x = m(0, 0) * r[j] + m(0, 1) * g[j] + m(0, 2) * b[j];
+                    float y = m(1, 0) * r[j] + m(1, 1) * g[j] + m(1, 2) * b[j];
+                    float z = m(2, 0) * r[j] + m(2, 1) * g[j] + m(2, 2) * b[j];
+                    r[j] = x;
+                    g[j] = y;
+                    b[j] = z;
                 }
-                float g = 1/_gamma;
-                for(int i = 0; i < pixels.size(); i++)
+            }
+        public:
+            virtual void Map(std::vector<Vector3f>& pixels, std::vector<unsigned char>& data, TonemapAccuracy /*accuracy*/) override
+            {
+                float bias = _exposureBias;
+                MapLanes(pixels, data, [&](float* r, float* g, float* b)
                 {
-                    auto temp = pixels[i];
-                    temp.x() = std::clamp(pixels[i].x(), 0.0f, 1.0f);
-                    temp.y() = std::clamp(pixels[i].y(), 0.0f, 1.0f);
-                    temp.z() = std::clamp(pixels[i].z(), 0.0f, 1.0f);
-
-                    unsigned char rd = (int)floor(pow(temp.x(),  g) * 255.0f);
-                    unsigned char gd = (int)floor(pow(temp.y(),  g) * 255.0f);
-                    unsigned char bd = (int)floor(pow(temp.z(),  g) * 255.0f);
-
-                    data[i*4]     = rd;
-                    data[i*4 + 1] = gd;
-                    data[i*4 + 2] = bd;
-                    data[i*4 + 3] = 255;
-                } 
-
+                    for(int j = 0; j < Lanes; j++)
+                    {
+                        r[j] *= bias;
+                        g[j] *= bias;
+                        b[j] *= bias;
+                    }
+                    transform(aces_input_matrix, r, g, b);
+                    for(int j = 0; j < Lanes; j++)
+                    {
+                        r[j] = rtt_and_odt_fit(r[j]);
+                        g[j] = rtt_and_odt_fit(g[j]);
+                        b[j] = rtt_and_odt_fit(b[j]);
+                    }
+                    transform(aces_output_matrix, r, g, b);
+                });
             }
     };
 
-}
\ No newline at end of file
+}
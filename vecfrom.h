@@ -2,67 +2,169 @@
 #include "Eigen/Dense"
 #include "Eigen/Geometry"
 #include "pugixml.hpp"
-#include <sstream>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
 #include <random>
 #include <iostream>
+#include "rng.h"
 
 using namespace Eigen;
 
 namespace raytracer
 {
+#if defined(_LIBCPP_VERSION) && _LIBCPP_VERSION < 200000
+    // libc++ only parses floating point with from_chars since LLVM 20
+    static constexpr bool FloatFromChars = false;
+#else
+    static constexpr bool FloatFromChars = true;
+#endif
+
+    // reads whitespace separated numbers (and single chars) straight out of
+    // pugixml's text buffer without copying or allocating
+    class NumberReader
+    {
+        public:
+            NumberReader(const char* text) : _cur(text), _end(text + std::strlen(text)) {}
+            NumberReader(const char* begin, const char* end) : _cur(begin), _end(end) {}
+            NumberReader(pugi::xml_node node) : NumberReader(node.first_child().value()) {}
+
+            // false once a value is missing or malformed, like a failed stream
+            template<typename... T>
+            bool Read(T&... values)
+            {
+                return (read(values) && ...);
+            }
+
+            // number of tokens left, for reserving before a read loop
+            size_t Count() const
+            {
+                size_t count = 0;
+                bool in = false;
+                for(const char* p = _cur; p < _end; p++)
+                {
+                    bool sp = space(*p);
+                    count += in == sp && !sp;
+                    in = !sp;
+                }
+                return count;
+            }
+        private:
+            const char* _cur;
+            const char* _end;
+
+            static bool space(char c)
+            {
+                return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+            }
+
+            template<typename T>
+            bool read(T& value)
+            {
+                while(_cur < _end && space(*_cur))
+                    _cur++;
+                if(_cur == _end)
+                    return false;
+                if constexpr(std::is_same_v<T, char>)
+                {
+                    value = *_cur++;
+                    return true;
+                }
+                else if constexpr(std::is_floating_point_v<T> && !FloatFromChars)
+                {
+                    return scan(value);
+                }
+                else
+                {
+                    if(*_cur == '+')
+                        _cur++;
+                    auto res = std::from_chars(_cur, _end, value);
+                    if(res.ec != std::errc())
+                    {
+                        _cur = _end;
+                        return false;
+                    }
+                    _cur = res.ptr;
+                    return true;
+                }
+            }
+
+            // strtod on a terminated copy of the token, for libraries without
+            // floating point from_chars
+            template<typename T>
+            bool scan(T& value)
+            {
+                char token[64];
+                size_t length = 0;
+                while(_cur + length < _end && !space(_cur[length]) && length < sizeof(token) - 1)
+                {
+                    token[length] = _cur[length];
+                    length++;
+                }
+                token[length] = 0;
+                char* end;
+                errno = 0;
+                value = std::is_same_v<T, float> ? std::strtof(token, &end) : std::strtod(token, &end);
+                // out of range fails, as it does for from_chars
+                if(end == token || errno == ERANGE)
+                {
+                    _cur = _end;
+                    return false;
+                }
+                _cur += end - token;
+                return true;
+            }
+    };
+
     static Vector2f Vec2fFrom(pugi::xml_node node)
     {
-        float x, y;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y;
+        float x = 0, y = 0;
+        NumberReader(node).Read(x, y);
         return Vector2f(x, y);
     }
 
     static Vector3f Vec3fFrom(pugi::xml_node node)
     {
-        float x, y, z;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y >> z;
+        float x = 0, y = 0, z = 0;
+        NumberReader(node).Read(x, y, z);
         return Vector3f(x, y, z);
     }
 
     static Vector4f Vec4fFrom(pugi::xml_node node)
     {
-        float x, y, z, w;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y >> z >> w;
+        float x = 0, y = 0, z = 0, w = 0;
+        NumberReader(node).Read(x, y, z, w);
         return Vector4f(x, y, z, w);
     }
 
     static Vector2i Vec2iFrom(pugi::xml_node node)
     {
-        int x, y;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y;
+        int x = 0, y = 0;
+        NumberReader(node).Read(x, y);
         return Vector2i(x, y);
     }
 
     static Vector3i Vec3iFrom(pugi::xml_node node)
     {
-        int x, y, z;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y >> z;
+        int x = 0, y = 0, z = 0;
+        NumberReader(node).Read(x, y, z);
         return Vector3i(x, y, z);
     }
 
     static Translation3f TranslationFrom(pugi::xml_node node)
     {
-        float x, y, z;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y >> z;
+        float x = 0, y = 0, z = 0;
+        NumberReader(node).Read(x, y, z);
         return Translation3f(x, y, z);
     }
 
     static AngleAxisf RotationFrom(pugi::xml_node node)
     {
-        float angle, x, y, z;
-        std::stringstream stream(node.first_child().value());
-        stream >> angle >> x >> y >> z;
+        float angle = 0, x = 0, y = 0, z = 0;
+        NumberReader(node).Read(angle, x, y, z);
         double pi = 3.14159265359;
         float rad = ((angle * pi) / (180.0f));            
         return AngleAxisf(rad, Vector3f(x, y, z));
@@ -70,24 +172,20 @@ namespace raytracer
 
     static AlignedScaling3f ScalingFrom(pugi::xml_node node)
     {
-        float x, y, z;
-        std::stringstream stream(node.first_child().value());
-        stream >> x >> y >> z;
+        float x = 0, y = 0, z = 0;
+        NumberReader(node).Read(x, y, z);
         return AlignedScaling3f(x, y, z);
     }
 
     static Transform<float, 3, Affine> CompositeFrom(pugi::xml_node node)
     {
         Transform<float, 3, Affine> ret;
-        std::stringstream stream(node.first_child().value());
-        stream >> ret(0,0) >> ret(0,1) >> ret(0,2) >> ret(0, 3);
-        stream >> ret(1,0) >> ret(1,1) >> ret(1,2) >> ret(1, 3);
-        stream >> ret(2,0) >> ret(2,1) >> ret(2,2) >> ret(2, 3);
-        stream >> ret(3,0) >> ret(3,1) >> ret(3,2) >> ret(3, 3);
+        NumberReader reader(node);
+        for(int i = 0; i < 4; i++)
+            reader.Read(ret(i,0), ret(i,1), ret(i,2), ret(i,3));
         return ret;
     }
 
-    static std::default_random_engine gen;
     static std::uniform_real_distribution<float> rand(-.5f,0.5f);
 
     static Vector3f Reflect(Vector3f in, Vector3f norm, float roughness)
@@ -111,16 +209,70 @@ namespace raytracer
 
             Vector3f u = reflect.cross(rp).normalized();
             Vector3f v = reflect.cross(u).normalized();                                  
-            float e1 = rand(gen);
-            float e2 = rand(gen);
+            float e1 = rand(Random::Thread());
+            float e2 = rand(Random::Thread());
             reflect = (reflect + roughness * (e1 * u + e2 * v)).normalized();
         }
         return reflect;
     }
 
+    // cosine weighted direction around normal, pdf = cos / pi
+    static Vector3f CosineSampleHemisphere(Vector3f normal, float r1, float r2)
+    {
+        Vector3f np;
+        float x = std::fabs(normal.x());
+        float y = std::fabs(normal.y());
+        float z = std::fabs(normal.z());
+        if(x <= y && x <= z) np = Vector3f(1, normal.y(), normal.z());
+        else if(y <= x && y <= z) np = Vector3f(normal.x(), 1, normal.z());
+        else np = Vector3f(normal.x(), normal.y(), 1);
+        Vector3f u = np.cross(normal).normalized();
+        Vector3f v = normal.cross(u).normalized();
+        float r = std::sqrt(r1);
+        float phi = 2 * M_PI * r2;
+        return (u * r * std::cos(phi) + v * r * std::sin(phi) + normal * std::sqrt(std::max(0.0f, 1 - r1))).normalized();
+    }
+
+    // direction around axis with pdf (exponent + 1) / 2pi * cos^exponent
+    static Vector3f PowerCosineSample(Vector3f axis, float exponent, float r1, float r2)
+    {
+        Vector3f np;
+        float x = std::fabs(axis.x());
+        float y = std::fabs(axis.y());
+        float z = std::fabs(axis.z());
+        if(x <= y && x <= z) np = Vector3f(1, axis.y(), axis.z());
+        else if(y <= x && y <= z) np = Vector3f(axis.x(), 1, axis.z());
+        else np = Vector3f(axis.x(), axis.y(), 1);
+        Vector3f u = np.cross(axis).normalized();
+        Vector3f v = axis.cross(u).normalized();
+        float cost = std::pow(r1, 1 / (exponent + 1));
+        float sint = std::sqrt(std::max(0.0f, 1 - cost * cost));
+        float phi = 2 * M_PI * r2;
+        return (u * sint * std::cos(phi) + v * sint * std::sin(phi) + axis * cost).normalized();
+    }
+
+    static float PowerHeuristic(float pdf, float other)
+    {
+        return (pdf * pdf) / (pdf * pdf + other * other);
+    }
+
+    static float Luminance(const Vector3f& rgb)
+    {
+        return 0.212671f * rgb.x() + 0.71516f * rgb.y() + 0.072169f * rgb.z();
+    }
+
     static Vector3f Vec3Pow(Vector3f in, float n)
     {
         return Vector3f(std::pow(in.x(), n), std::pow(in.y(), n), std::pow(in.z(), n));
     }
 
+    // FNV-1a, pass the previous hash to continue it over more data
+    static uint64_t Fnv1a(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+    {
+        auto bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++)
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        return hash;
+    }
+
 }
\ No newline at end of file